@@ -1,3 +1,5 @@
+// statx, see bcc_file_stat
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,7 +40,21 @@ void log_available_subcommands(const char *program, BCC_Log_Level level)
     bcc_log(level, "    build (default)");
     bcc_log(level, "    dist");
     bcc_log(level, "    svg");
+    bcc_log(level, "    cache-server [DIR] [[HOST:]PORT]  serve the object cache in DIR over HTTP (default: 127.0.0.1:8080)");
+    bcc_log(level, "    bench-spawn [N] [MB]               time N spawns with fork+exec and posix_spawn from a process with MB of heap (default: 1000 0)");
+    bcc_log(level, "    bench-link [N]                     build, then time the link of the program N times with every linker available (default: 5)");
     bcc_log(level, "    help");
+    bcc_log(level, "Options:");
+    bcc_log(level, "    -jN                 run N jobs in parallel (default: number of CPUs)");
+    bcc_log(level, "    --cache-dir=DIR     keep the object cache in DIR (default: $BCC_CACHE_DIR or "BCC_CACHE_DEFAULT_DIR")");
+    bcc_log(level, "    --no-cache          do not use the object cache");
+    bcc_log(level, "    --cache-size=SIZE   evict old cache entries above SIZE, K/M/G suffixes (default: $BCC_CACHE_SIZE or 5G)");
+    bcc_log(level, "    --remote-cache=URL  share the object cache through a cache-server at URL (default: $BCC_REMOTE_CACHE)");
+    bcc_log(level, "    --mem-budget=SIZE   keep the expected peak memory of the jobs below SIZE (default: $BCC_MEM_BUDGET or the available memory)");
+    bcc_log(level, "    --keep-going        build as much as possible after a failure instead of stopping right away");
+    bcc_log(level, "    --changes=MODE      how outputs are found out of date: mtime, or hash to also compare the content of their inputs (default: mtime)");
+    bcc_log(level, "    --linker=NAME       link with bfd, gold, lld, mold, or auto for the fastest one available (default: the one of the compiler)");
+    bcc_log(level, "    --unity[=K]         compile raylib as K unity translation units balanced by their compile times (default K: the number of jobs)");
 }
 
 // Extensible config logging function
@@ -54,11 +70,46 @@ void log_config(BCC_Log_Level level)
 
 int main(int argc, char **argv)
 {
+    if (!bcc_parse_options(argc, argv)) {
+        log_available_subcommands(argv[0], BCC_ERROR);
+        return 1;
+    }
+
+    const char *subcommand = bcc_options.args.count > 1 ? bcc_options.args.items[1] : "build";
+    const char *cache_dir = bcc_cache_dir();
+    if (cache_dir == NULL) cache_dir = BCC_CACHE_DEFAULT_DIR;
+
+    if (strcmp(subcommand, "cache-server") == 0) {
+        const char *dir = bcc_options.args.count > 2 ? bcc_options.args.items[2] : cache_dir;
+        const char *address = bcc_options.args.count > 3 ? bcc_options.args.items[3] : "127.0.0.1:8080";
+        return bcc_cache_server(dir, address) ? 0 : 1;
+    }
+
+    if (strcmp(subcommand, "bench-spawn") == 0) {
+        size_t count = bcc_options.args.count > 2 ? strtoul(bcc_options.args.items[2], NULL, 10) : 1000;
+        size_t ballast_mb = bcc_options.args.count > 3 ? strtoul(bcc_options.args.items[3], NULL, 10) : 0;
+        return bcc_bench_spawn(count, ballast_mb) ? 0 : 1;
+    }
+
+    // Transfers between the local and the remote cache, started by bcc_graph_build
+    if (strcmp(subcommand, "cache-pull") == 0 || strcmp(subcommand, "cache-push") == 0) {
+        const char *url = bcc_remote_cache_url();
+        BCC_Cache cache;
+        if (url == NULL || !bcc_cache_init(&cache, cache_dir)) return 1;
+        const char **keys = bcc_options.args.items + 2;
+        size_t keys_count = bcc_options.args.count - 2;
+        if (strcmp(subcommand, "cache-pull") == 0) return bcc_remote_cache_pull(&cache, url, keys, keys_count) ? 0 : 1;
+        return bcc_remote_cache_push(&cache, url, keys, keys_count) ? 0 : 1;
+    }
+
     bcc_log(BCC_INFO, "Building... ");
     log_config(BCC_INFO);
 
     // Build function here.
-    build_chain(argc, argv);
+    bcc_trace_begin("build");
+    bool built = build_chain(argc, argv);
+    bcc_trace_end();
+    return built ? 0 : 1;
 }
 
 #else // if not configured, generate the config file
@@ -104,6 +155,7 @@ int main(int argc, char **argv) {
 
     if (!bcc_mkdir_if_not_exists("build")) return 1;
 
+    bcc_trace_begin("configure");
     int config_exists = bcc_file_exists(CONFIG_PATH);
     if (config_exists < 0) return 1;
     if (config_exists == 0) {
@@ -119,11 +171,24 @@ int main(int argc, char **argv) {
     BCC_Cmd cmd = {0};
     const char *configured_binary = "build/bcc.configured";
     bcc_cmd_append(&cmd, BCC_REBUILD_URSELF(configured_binary, "bc.c"), "-DCONFIGURED");
+#ifdef BCC_REBUILD_URSELF_DEPFILE
+    // Skip the compile if neither the sources, the config, the flags nor the compiler have changed
+    const char *configured_depfile = "build/bcc.configured.d";
+    bcc_cmd_append(&cmd, BCC_REBUILD_URSELF_DEPFILE(configured_depfile));
+    if (bcc_needs_rebuild_fingerprint(configured_binary, cmd, configured_depfile)) {
+        if (!bcc_cmd_run_sync(cmd)) return 1;
+        bcc_fingerprint_store(configured_binary, cmd, configured_depfile);
+    } else {
+        bcc_log(BCC_INFO, "`%s` is up to date", configured_binary);
+    }
+#else
     if (!bcc_cmd_run_sync(cmd)) return 1;
+#endif // BCC_REBUILD_URSELF_DEPFILE
+    bcc_trace_end();
 
     cmd.count = 0;
     bcc_cmd_append(&cmd, configured_binary);
-    bcc_da_append_many(&cmd, argv, argc);
+    bcc_da_append_many(&cmd, argv + 1, argc - 1);
     if (!bcc_cmd_run_sync(cmd)) return 1;
 
     return 0;
@@ -23,6 +23,8 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <time.h>
 
 #ifdef _WIN32
 #    define WIN32_LEAN_AND_MEAN
@@ -33,12 +35,27 @@
 #    include <windows.h>
 #    include <direct.h>
 #    include <shellapi.h>
+#    include <psapi.h>
+#    include <winsock2.h>
+#    include <ws2tcpip.h>
+#    ifdef _MSC_VER
+#        pragma comment(lib, "ws2_32.lib")
+#    endif
 #else
 #    include <sys/types.h>
 #    include <sys/wait.h>
+#    include <sys/resource.h>
 #    include <sys/stat.h>
 #    include <unistd.h>
 #    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <utime.h>
+#    include <sys/file.h>
+#    include <sys/socket.h>
+#    include <netdb.h>
+#    include <signal.h>
+#    include <poll.h>
+#    include <spawn.h>
 #endif
 
 #ifdef _WIN32
@@ -81,6 +98,8 @@ bool bcc_copy_file(const char *src_path, const char *dst_path);
 bool bcc_copy_directory_recursively(const char *src_path, const char *dst_path);
 bool bcc_read_entire_dir(const char *parent, BCC_File_Paths *children);
 bool bcc_write_entire_file(const char *path, const void *data, size_t size);
+// Same as bcc_write_entire_file, but leaves the file alone (and its mtime) if it already has that content
+bool bcc_write_entire_file_if_changed(const char *path, const void *data, size_t size);
 BCC_File_Type bcc_get_file_type(const char *path);
 
 #define bcc_return_defer(value) do { result = (value); goto defer; } while(0)
@@ -105,18 +124,18 @@ BCC_File_Type bcc_get_file_type(const char *path);
 // Append several items to a dynamic array
 #define bcc_da_append_many(da, new_items, new_items_count)                                  \
     do {                                                                                    \
-        if ((da)->count + new_items_count > (da)->capacity) {                               \
+        if ((da)->count + (new_items_count) > (da)->capacity) {                               \
             if ((da)->capacity == 0) {                                                      \
                 (da)->capacity = BCC_DA_INIT_CAP;                                           \
             }                                                                               \
-            while ((da)->count + new_items_count > (da)->capacity) {                        \
+            while ((da)->count + (new_items_count) > (da)->capacity) {                        \
                 (da)->capacity *= 2;                                                        \
             }                                                                               \
             (da)->items = BCC_REALLOC((da)->items, (da)->capacity*sizeof(*(da)->items)); \
             BCC_ASSERT((da)->items != NULL && "Buy more RAM lol");                          \
         }                                                                                   \
-        memcpy((da)->items + (da)->count, new_items, new_items_count*sizeof(*(da)->items)); \
-        (da)->count += new_items_count;                                                     \
+        memcpy((da)->items + (da)->count, (new_items), (new_items_count)*sizeof(*(da)->items)); \
+        (da)->count += (new_items_count);                                                     \
     } while (0)
 
 typedef struct {
@@ -154,6 +173,15 @@ typedef int BCC_Proc;
 #define BCC_INVALID_PROC (-1)
 #endif // _WIN32
 
+// File descriptor
+#ifdef _WIN32
+typedef HANDLE BCC_Fd;
+#define BCC_INVALID_FD INVALID_HANDLE_VALUE
+#else
+typedef int BCC_Fd;
+#define BCC_INVALID_FD (-1)
+#endif // _WIN32
+
 typedef struct {
     BCC_Proc *items;
     size_t count;
@@ -165,6 +193,19 @@ bool bcc_procs_wait(BCC_Procs procs);
 // Wait until the process has finished
 bool bcc_proc_wait(BCC_Proc proc);
 
+// Resources a finished child process has used, as reported by the kernel
+typedef struct {
+    uint64_t wall_us;    // From the start of the process until it has been waited on
+    uint64_t user_us;
+    uint64_t sys_us;
+    uint64_t max_rss_kb; // Peak resident set size
+    uint64_t read_ops;   // Block input operations (I/O read operations on Windows)
+    uint64_t write_ops;  // Block output operations (I/O write operations on Windows)
+} BCC_Proc_Usage;
+
+// Same as bcc_proc_wait, but also collects what the process has used
+bool bcc_proc_wait_usage(BCC_Proc proc, BCC_Proc_Usage *usage);
+
 // A command - the main workhorse of BCC. BCC is all about building commands an running them
 typedef struct {
     const char **items;
@@ -189,6 +230,331 @@ BCC_Proc bcc_cmd_run_async(BCC_Cmd cmd);
 // Run command synchronously
 bool bcc_cmd_run_sync(BCC_Cmd cmd);
 
+// Spawn `count` trivial commands one after another with fork+execvp and with posix_spawnp,
+// which bcc uses, and report the spawns per second of each. `ballast_mb` of touched heap make
+// the address space of the parent bigger, since that is what the page table copy of fork
+// scales with.
+bool bcc_bench_spawn(size_t count, size_t ballast_mb);
+
+// How the graph executor tells that an output is out of date
+typedef enum {
+    // An input is newer than the output. Nanosecond mtimes where the platform has them
+    BCC_CHANGES_MTIME = 0,
+    // Same, but an output whose inputs are newer is only rebuilt if their content differs
+    // from the last build. Only the files whose metadata has changed get hashed. Catches
+    // checkouts and `touch` without edits, and rebuilt objects that have come out the same.
+    BCC_CHANGES_HASH,
+} BCC_Change_Detection;
+
+// Options shared by the whole build. Parsed from the command line by bcc_parse_options.
+typedef struct {
+    size_t max_jobs;       // -jN. 0 means the number of online CPUs
+    const char *cache_dir; // --cache-dir=DIR. NULL means $BCC_CACHE_DIR or BCC_CACHE_DEFAULT_DIR
+    bool no_cache;         // --no-cache
+    uint64_t cache_size;   // --cache-size=SIZE. 0 means $BCC_CACHE_SIZE or BCC_CACHE_DEFAULT_SIZE
+    const char *remote_cache; // --remote-cache=URL. NULL means $BCC_REMOTE_CACHE
+    uint64_t mem_budget;   // --mem-budget=SIZE. 0 means $BCC_MEM_BUDGET or the available memory
+    bool keep_going;       // --keep-going. Build as much as possible after a failure instead of cancelling the running jobs
+    BCC_Change_Detection changes; // --changes=mtime|hash
+    const char *linker;    // --linker=bfd|gold|lld|mold|auto. NULL means the default of the compiler, see bcc_rule_linker
+    bool unity;            // --unity[=K]. Let the build script batch its sources into unity translation units, see bcc_unity_plan
+    size_t unity_groups;   // K of --unity=K. 0 means as many as the jobs
+    BCC_Cmd args;          // Everything that is not an option, in order. The program path included
+} BCC_Options;
+
+// Parse the build options out of the command line. Arguments that do not start with `-`
+// (subcommands, the program path, etc) are collected into bcc_options.args for the caller.
+bool bcc_parse_options(int argc, char **argv);
+
+// Parse a size with an optional K, M or G suffix (powers of 1024). Fails on 0, on a sign and
+// on sizes that do not fit in 64 bits
+bool bcc_parse_size(const char *cstr, uint64_t *size);
+
+// Number of online CPUs
+size_t bcc_nprocs(void);
+
+// Maximum amount of jobs run in parallel. Either -jN or bcc_nprocs()
+size_t bcc_max_jobs(void);
+
+// Memory available to the system right now in KiB (MemAvailable of /proc/meminfo on Linux).
+// 0 if it is not known.
+uint64_t bcc_available_memory_kb(void);
+
+// How much memory the jobs may take together in KiB. Either --mem-budget, $BCC_MEM_BUDGET or
+// bcc_available_memory_kb(). UINT64_MAX if there is no limit.
+uint64_t bcc_mem_budget_kb(void);
+
+// A command scheduled on a job pool
+typedef struct {
+    BCC_Cmd cmd;  // A copy of the command array. The strings themselves are not copied
+    BCC_Proc proc;
+    size_t tag;   // Caller defined value to identify the job once it has finished
+    size_t slot;  // Which of the max_jobs slots the job occupies, 0 based
+    uint64_t mem_kb; // Peak memory the job is expected to take, see BCC_Jobs.mem_budget_kb
+    BCC_Proc_Usage usage; // Filled in once the job has been reaped
+    BCC_Fd output_fd;     // Where the job's stdout and stderr go: a pipe, or a temporary file on Windows
+    BCC_String_Builder output; // What the job has written so far, at most BCC_JOB_OUTPUT_CAP of it
+    FILE *output_spill;   // The rest of the output once there is more than BCC_JOB_OUTPUT_CAP
+} BCC_Job;
+
+// How much of the output of a single job is kept in memory
+#ifndef BCC_JOB_OUTPUT_CAP
+#define BCC_JOB_OUTPUT_CAP (64*1024)
+#endif // BCC_JOB_OUTPUT_CAP
+
+typedef struct {
+    BCC_Job *items;
+    size_t count;
+    size_t capacity;
+} BCC_Job_List;
+
+// Job pool. Runs at most max_jobs commands at once and reaps them in the order they finish,
+// starting the next queued command as soon as a slot frees up. Jobs started with an expected
+// peak memory are only admitted while the sum of the running ones fits into mem_budget_kb, so
+// the heavy jobs are throttled while the small ones still run wide. A job that does not fit
+// even on its own still runs once the pool is empty.
+//
+// Every job runs in a process group of its own, so it can be cancelled together with the
+// processes it has started itself (cc1, as, ld). Unless --keep-going is given, the first
+// failed job cancels all the others. SIGINT and SIGTERM cancel them too while the pool has
+// jobs running, since they do not reach the jobs' process groups on their own.
+//
+// The output of every job is captured and printed in one piece once the job has finished, so
+// the diagnostics of parallel compilers do not interleave.
+//
+//   BCC_Jobs jobs = {0};
+//   for (...) {
+//       cmd.count = 0;
+//       bcc_cmd_append(&cmd, "cc", "-c", input_path, "-o", output_path);
+//       bcc_jobs_push(&jobs, cmd);
+//   }
+//   if (!bcc_jobs_wait(&jobs)) return false;
+typedef struct {
+    BCC_Job_List queued;
+    size_t queued_next; // Index of the next queued job to start
+    BCC_Job_List running;
+    size_t max_jobs;    // 0 means bcc_max_jobs()
+    uint64_t mem_budget_kb; // 0 means bcc_mem_budget_kb() as it is before the first job starts
+    uint64_t mem_used_kb;   // Expected peak memory of the running jobs together
+    size_t tokens;          // Jobserver tokens taken by the pool, see bcc_jobserver_acquire
+    bool wants_token;       // A job is waiting for a token, bcc_jobs_reap wakes up once there is one
+    bool interrupted;       // SIGINT or SIGTERM has cancelled the pool, see bcc_jobs_reap
+} BCC_Jobs;
+
+// Queue a command. It is started by bcc_jobs_wait once a slot is available
+void bcc_jobs_push(BCC_Jobs *jobs, BCC_Cmd cmd);
+
+// Run all the queued commands to completion. Returns false if any of them failed
+bool bcc_jobs_wait(BCC_Jobs *jobs);
+
+// Lower level interface for schedulers that decide what to run next on their own
+bool bcc_jobs_has_free_slot(BCC_Jobs *jobs);
+bool bcc_jobs_start(BCC_Jobs *jobs, BCC_Cmd cmd, size_t tag);
+
+// Whether a job expected to take mem_kb at its peak fits into the job limit and the memory
+// budget right now. It does not take a jobserver token, bcc_jobs_has_free_slot does that once
+// the job is sure to start.
+bool bcc_jobs_has_room(BCC_Jobs *jobs, uint64_t mem_kb);
+bool bcc_jobs_start_mem(BCC_Jobs *jobs, BCC_Cmd cmd, size_t tag, uint64_t mem_kb);
+
+// Block until any of the running jobs has finished. The finished job is moved into `job`,
+// the caller owns its cmd after that. Returns false if there is nothing to reap. If the pool
+// wants a jobserver token, it also wakes up once it has got one. Then `job->proc` is
+// BCC_INVALID_PROC and there is a free slot to fill. On SIGINT or SIGTERM the pool is
+// cancelled, jobs->interrupted is set and it returns false as well.
+bool bcc_jobs_reap(BCC_Jobs *jobs, BCC_Job *job, bool *ok);
+
+// Terminate the running jobs together with their process groups, wait for them and drop
+// whatever is still queued. The jobs that are still there after BCC_JOBS_CANCEL_GRACE_MS are
+// killed.
+void bcc_jobs_cancel(BCC_Jobs *jobs);
+
+#ifndef BCC_JOBS_CANCEL_GRACE_MS
+#define BCC_JOBS_CANCEL_GRACE_MS 100
+#endif // BCC_JOBS_CANCEL_GRACE_MS
+
+void bcc_jobs_free(BCC_Jobs *jobs);
+
+// GNU make jobserver (https://www.gnu.org/software/make/manual/html_node/Job-Slots.html).
+// Every job of a pool but the first one takes a token from the jobserver of MAKEFLAGS, so a
+// build run by `make -jN` shares the N slots with the rest of the make instead of adding its
+// own. Without a jobserver in MAKEFLAGS, bcc serves one with bcc_max_jobs() slots and exports
+// it, so the tools it runs (`gcc -flto=jobserver`, nested makes) stay within the same limit.
+// The pools set it up on their own, there is no need to call these by hand.
+void bcc_jobserver_init(void);
+bool bcc_jobserver_acquire(void); // Never blocks, returns false if there is no token right now
+void bcc_jobserver_release(void);
+
+#ifndef BCC_TRACE_PATH
+#define BCC_TRACE_PATH "build/bcc.trace.json"
+#endif // BCC_TRACE_PATH
+
+// Chrome trace of the build, open it in chrome://tracing or https://ui.perfetto.dev. Every
+// command run through bcc_cmd_run_async is a slice from its start until it is waited on, on the
+// track of the job slot it has taken (track 0 for the commands outside of a job pool). The phases
+// of bcc itself are put on track 0 with bcc_trace_begin/bcc_trace_end.
+//
+// The first bcc process of a build creates BCC_TRACE_PATH and passes it down to its children
+// in the BCC_TRACE_FILE environment variable, so all the stages end up in one file. Events are
+// appended as soon as they happen in the JSON Array Format, which does not need the closing `]`.
+
+// Microseconds of a monotonic clock that is shared by all the processes of the machine
+uint64_t bcc_trace_now(void);
+
+void bcc_trace_begin(const char *name);
+void bcc_trace_end(void);
+
+// Called by the process functions, there is no need to call them by hand
+void bcc_trace_proc_start(BCC_Proc proc, BCC_Cmd cmd);
+void bcc_trace_proc_slot(BCC_Proc proc, size_t slot);
+// Also measures the wall time of the process into usage->wall_us
+void bcc_trace_proc_end(BCC_Proc proc, int exit_code, BCC_Proc_Usage *usage);
+
+// Append cstr as a quoted JSON string
+void bcc_sb_append_json_string(BCC_String_Builder *sb, const char *cstr);
+
+// A rule of the build graph. Runs cmd to produce the outputs out of the inputs. A rule
+// depends on every other rule that produces one of its inputs. Rules without a cmd are
+// phony and only group their inputs together.
+typedef struct BCC_Rule {
+    BCC_File_Paths outputs;
+    BCC_File_Paths inputs;
+    BCC_Cmd cmd;
+    const char *depfile; // Make style depfile written by cmd, see bcc_rule_depfile
+    bool cacheable;      // A compile whose first output can be served from the object cache
+    bool failed;         // Set by bcc_graph_build when cmd has failed
+    // Builds the rule in process instead of running cmd, see bcc_rule_ar. Returns 1 on success,
+    // 0 on failure and -1 to run cmd after all
+    int (*builtin)(const struct BCC_Rule *rule);
+} BCC_Rule;
+
+typedef struct {
+    BCC_Rule *items;
+    size_t count;
+    size_t capacity;
+} BCC_Graph;
+
+// Add a new empty rule to the graph. The returned pointer is valid until the next rule
+// is added.
+//
+//   BCC_Rule *rule = bcc_graph_rule(&graph);
+//   bcc_rule_outputs(rule, "build/main.o");
+//   bcc_rule_inputs(rule, "src/main.c");
+//   bcc_cmd_append(&rule->cmd, "cc", "-c", "src/main.c", "-o", "build/main.o");
+BCC_Rule *bcc_graph_rule(BCC_Graph *graph);
+
+#define bcc_rule_outputs(rule, ...) bcc_cmd_append(&(rule)->outputs, __VA_ARGS__)
+#define bcc_rule_inputs(rule, ...) bcc_cmd_append(&(rule)->inputs, __VA_ARGS__)
+
+// Make the compiler of the rule write the headers it has included into depfile_path
+// (-MMD -MF). Every header listed there becomes an implicit input of the rule.
+void bcc_rule_depfile(BCC_Rule *rule, const char *depfile_path);
+
+// Add a rule that precompiles the headers with the compiler and flags of the translation units
+// that are going to use them (no -c, -o or sources). A header that includes them all is generated
+// into dir as pch_<fingerprint>.h, the fingerprint being the one of the headers and the flags,
+// so every set of headers and flags gets its own precompiled header and switching between them
+// does not rebuild any. The precompiled header depends on the headers it has parsed like any
+// other compile. Returns the generated header to pass to bcc_rule_pch, NULL on failure.
+// NOTE: gcc style, the precompiled header is the generated one with .gch appended
+const char *bcc_graph_pch(BCC_Graph *graph, const char *dir, const char **headers, size_t headers_count, BCC_Cmd flags);
+
+// Make the compile of the rule use a precompiled header of bcc_graph_pch (-include), and warn
+// when it does not match the flags of the rule (-Winvalid-pch). Append it after the compile
+// flags, since the flags have to be the ones the header has been precompiled with.
+void bcc_rule_pch(BCC_Rule *rule, const char *pch);
+
+// Bring every output of the graph up to date. Rules run as soon as all of the rules they
+// depend on have finished, so independent chains overlap on the job pool. The compiles of the
+// graph are written into BCC_COMPILE_COMMANDS_PATH on the way.
+bool bcc_graph_build(BCC_Graph *graph, BCC_Jobs *jobs);
+
+#ifndef BCC_COMPILE_COMMANDS_PATH
+#define BCC_COMPILE_COMMANDS_PATH "build/compile_commands.json"
+#endif // BCC_COMPILE_COMMANDS_PATH
+
+// Write the compilation database (compile_commands.json) of every rule of the graph that
+// compiles (-c) one of its inputs, for clangd and friends. The file is only rewritten when its
+// content changes, so editors do not reindex after every build. The precompiled headers of
+// bcc_rule_pch are left out, clang cannot load the ones of gcc.
+bool bcc_compile_commands_write(const BCC_Graph *graph, const char *file_path);
+
+void bcc_graph_free(BCC_Graph *graph);
+
+// Unity (jumbo) builds: several sources compiled as a single translation unit that includes
+// all of them, so the headers they share are parsed once per group instead of once per source.
+typedef struct {
+    BCC_File_Paths sources; // What the group compiles, in order
+    const char *path;       // Generated translation unit including the sources. NULL for a single source that is compiled as is
+    const char *object;     // <dir>/unity_<k>.o, or the object of the single source
+} BCC_Unity_Group;
+
+typedef struct {
+    BCC_Unity_Group *items;
+    size_t count;
+    size_t capacity;
+} BCC_Unity;
+
+// Split the sources into at most max_groups groups (0 means bcc_max_jobs()) that take about
+// the same time to compile (LPT), going by how long their objects took in the build log, or by
+// their size when that is not known. The translation units are generated into dir as
+// unity_<k>.c and kept for as long as the sources and the amount of groups stay the same, so
+// a different split does not rebuild everything on every run. Sources that did not combine
+// with the others before (see bcc_unity_fallback) get a group of their own.
+// NOTE: dir and relative sources are both relative to the working directory
+bool bcc_unity_plan(BCC_Unity *unity, const char *dir, const char **sources, const char **objects, size_t count, size_t max_groups);
+
+// Call it after every bcc_graph_build of the unity groups. The sources of the groups that have
+// failed are compiled on their own by the next bcc_unity_plan of the process. Once that build
+// has run, the groups whose sources all did compile like that are remembered, so bcc_unity_plan
+// keeps their sources out of the groups until they change. A group with a source that does not
+// compile on its own either just has a plain compile error, and is left alone. Returns whether any group has failed, that is whether the build is worth
+// another try without them.
+bool bcc_unity_fallback(const BCC_Unity *unity, const BCC_Graph *graph);
+
+void bcc_unity_free(BCC_Unity *unity);
+
+#ifndef BCC_UNITY_EXCLUDE_PATH
+#define BCC_UNITY_EXCLUDE_PATH "build/.bcc_unity_exclude"
+#endif // BCC_UNITY_EXCLUDE_PATH
+
+// Write a GNU ar archive of the members with the symbol index of their ELF or COFF objects, the
+// same as `ar -crs` would, or `ar -crsT` for a thin archive that refers to the members by path
+// instead of containing them. The members that are still the same as in the existing archive
+// keep the symbols indexed for them there, and an archive that comes out the same is only touched.
+// RETURNS:
+//  1 - the archive has been written
+//  0 - error, it is logged
+// -1 - a member is not an object the index can be made of here (LTO, big objects, etc), `ar` has to do it
+int bcc_ar_write(const char *archive_path, const char **member_paths, size_t count, bool thin);
+
+// Make the rule archive its inputs into its first output with bcc_ar_write in process instead of
+// running `ar`. The command of the rule becomes the `ar` equivalent, which is what runs on a
+// fresh archive when bcc_ar_write cannot do it. Call it once the inputs are all there.
+void bcc_rule_ar(BCC_Rule *rule, bool thin);
+
+// The linkers --linker=auto picks from, the fastest first
+#define BCC_LINKERS "mold", "lld", "gold", "bfd"
+
+// Where the linkers found by bcc_linker_available are remembered
+#ifndef BCC_LINKERS_PATH
+#define BCC_LINKERS_PATH "build/.bcc_linkers"
+#endif // BCC_LINKERS_PATH
+
+// Whether the compiler can link with the linker (-fuse-ld=linker). Found out by linking an
+// empty program once per version of the compiler, the answer is kept in BCC_LINKERS_PATH.
+bool bcc_linker_available(const char *compiler, const char *linker);
+
+// Make the link of the rule use the linker of --linker: the fastest one of BCC_LINKERS that is
+// available for auto, and the default of the compiler without --linker. The compiler is the
+// first argument of the command. Fails if the linker asked for is not available.
+bool bcc_rule_linker(BCC_Rule *rule);
+
+// Time the link of the rule that produces output_path with the default linker and with every one
+// of BCC_LINKERS that is available, `runs` times each. The links write <output_path>.bench, so
+// the build is left alone. The inputs of the link have to be built already.
+bool bcc_bench_link(const BCC_Graph *graph, const char *output_path, size_t runs);
+
 #ifndef BCC_TEMP_CAPACITY
 #define BCC_TEMP_CAPACITY (8*1024*1024)
 #endif // BCC_TEMP_CAPACITY
@@ -203,15 +569,273 @@ int is_path1_modified_after_path2(const char *path1, const char *path2);
 bool bcc_rename(const char *old_path, const char *new_path);
 int bcc_needs_rebuild(const char *output_path, const char **input_paths, size_t input_paths_count);
 int bcc_needs_rebuild1(const char *output_path, const char *input_path);
+
+// Same as bcc_needs_rebuild, but the dependencies listed in the depfile generated by the
+// compiler are checked as well. A missing depfile means the output must be rebuilt.
+int bcc_needs_rebuild_depfile(const char *output_path, const char *depfile_path, const char **input_paths, size_t input_paths_count);
+
+// Parse the prerequisites of a make style depfile (the one produced by `-MMD -MF`) into deps.
+// The paths are allocated in the temporary storage.
+bool bcc_parse_depfile(const char *depfile_path, BCC_File_Paths *deps);
 int bcc_file_exists(const char *file_path);
 
+// Get the last modification time of a file in nanoseconds (or whatever precision the platform has)
+// RETURNS:
+//  0 - file does not exists
+//  1 - mtime is set
+// -1 - error while getting the mtime. The error is logged
+int bcc_file_mtime(const char *file_path, uint64_t *mtime);
+
+// What tells whether a file has changed without reading it
+typedef struct {
+    uint64_t mtime; // Nanoseconds (in steps of 100 on Windows)
+    uint64_t size;
+    uint64_t inode; // File index on Windows
+    uint64_t dev;   // Volume serial number on Windows
+} BCC_File_Stat;
+
+// Same as bcc_file_mtime, but gets the whole BCC_File_Stat. Uses statx where it is available
+int bcc_file_stat(const char *file_path, BCC_File_Stat *file_stat);
+
+// Set the last modification time of a file to now
+bool bcc_touch(const char *file_path);
+
+// Content hash of a file. It is remembered together with the BCC_File_Stat of the file and
+// only computed again once that has changed, so checking a file that has not changed costs a
+// single stat. The hashes persist across builds in BCC_HASH_CACHE_PATH.
+bool bcc_file_hash(const char *file_path, uint64_t *hash);
+
+// Write the hashes of bcc_file_hash into BCC_HASH_CACHE_PATH. bcc_graph_build and the
+// fingerprints do that on their own.
+bool bcc_file_hashes_save(void);
+
+#ifndef BCC_HASH_CACHE_PATH
+#define BCC_HASH_CACHE_PATH "build/.bcc_hashes"
+#endif // BCC_HASH_CACHE_PATH
+
+// Files modified less than that long ago are hashed every time, see bcc_file_hash
+#ifndef BCC_HASH_CACHE_RACY_NS
+#define BCC_HASH_CACHE_RACY_NS 1000000000ULL
+#endif // BCC_HASH_CACHE_RACY_NS
+
+// FNV-1a. Start with BCC_HASH_INIT and feed the data through bcc_hash_update
+#define BCC_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t bcc_hash_update(uint64_t hash, const void *data, size_t size);
+uint64_t bcc_hash_cstr(uint64_t hash, const char *cstr);
+
+// Set of interned paths. Every path gets an id which is its index in paths. The strings
+// are not copied, so they must outlive the table.
+typedef struct {
+    BCC_File_Paths paths;
+    uint32_t *slots;  // Open addressing table: hash of path -> id + 1
+    size_t capacity;
+} BCC_Path_Table;
+
+bool bcc_path_table_find(const BCC_Path_Table *table, const char *path, uint32_t *id);
+// The path must not be in the table yet
+uint32_t bcc_path_table_add(BCC_Path_Table *table, const char *path);
+void bcc_path_table_free(BCC_Path_Table *table);
+
+// Where the graph executor keeps the dependencies discovered through depfiles
+#ifndef BCC_DEPS_LOG_PATH
+#define BCC_DEPS_LOG_PATH "build/.bcc_deps"
+#endif // BCC_DEPS_LOG_PATH
+
+// The deps log and the build log are rewritten with only the latest record of every output
+// once they have more than BCC_DEPS_LOG_COMPACT_MIN records and most of them are outdated
+#ifndef BCC_DEPS_LOG_COMPACT_MIN
+#define BCC_DEPS_LOG_COMPACT_MIN 100
+#endif // BCC_DEPS_LOG_COMPACT_MIN
+
+typedef struct {
+    uint64_t mtime;       // mtime of the output at the moment the dependencies were recorded
+    const uint32_t *ids;  // Path ids of the dependencies
+    uint32_t count;
+} BCC_Deps_Record;
+
+// Append-only binary log of dependencies, similar to .ninja_deps. Every path is interned
+// into an id once, and every output maps to the ids of its dependencies. The log is mapped
+// into memory on load, so checking a no-op build does not have to parse any depfile.
+//
+// File format (native endianness, everything is aligned to 4 bytes):
+//   "BCCDEPS\n" u32 version u32 reserved
+//   records: u32 header, where the highest bit marks a deps record and the rest is the size
+//     path record: NULL-padded path, u32 ~id
+//     deps record: u32 output id, u32 mtime low, u32 mtime high, u32 ids...
+typedef struct {
+    BCC_Path_Table paths;
+    struct {
+        BCC_Deps_Record *items;
+        size_t count;
+        size_t capacity;
+    } deps;                // id -> latest deps record, count == 0 if there is none
+    size_t loaded_paths;   // Paths below that id point into the mapping, the rest are owned
+    size_t records;        // Amount of deps records in the file
+    const char *file_path;
+    FILE *file;
+    void *mapping;
+    size_t mapping_size;
+} BCC_Deps_Log;
+
+bool bcc_deps_log_open(BCC_Deps_Log *log, const char *file_path);
+const BCC_Deps_Record *bcc_deps_log_lookup(const BCC_Deps_Log *log, const char *output_path);
+bool bcc_deps_log_record(BCC_Deps_Log *log, const char *output_path, uint64_t mtime, const char **deps, size_t deps_count);
+bool bcc_deps_log_close(BCC_Deps_Log *log);
+
+// Where the graph executor keeps what it knows about the outputs it has built
+#ifndef BCC_BUILD_LOG_PATH
+#define BCC_BUILD_LOG_PATH "build/.bcc_log"
+#endif // BCC_BUILD_LOG_PATH
+
+typedef struct {
+    uint64_t cmd_hash;  // bcc_cmd_hash of the command that has produced the output
+    uint64_t cpu_us;    // User and system time the command has taken last time it ran
+    uint64_t max_rss_kb;// Peak memory of the command last time it ran
+    uint64_t wall_us;   // How long the command has taken last time it ran
+    uint64_t inputs_hash;// Content of everything the output has been built from, see BCC_CHANGES_HASH. 0 if unknown
+} BCC_Build_Log_Entry;
+
+// Small text database about the outputs of the build, similar to .ninja_log. Every line is
+// `<output>\t<fields...>`, new lines are appended as outputs are built and the latest line
+// of an output wins. Missing trailing fields read as 0, so new fields can be added at the end.
+typedef struct {
+    BCC_Path_Table outputs;
+    struct {
+        BCC_Build_Log_Entry *items;
+        size_t count;
+        size_t capacity;
+    } entries;            // id of output -> entry
+    size_t lines;         // Amount of entries in the file
+    size_t loaded_outputs;// Outputs below that id point into content, the rest are owned
+    BCC_String_Builder content;
+    const char *file_path;
+    FILE *file;
+} BCC_Build_Log;
+
+bool bcc_build_log_open(BCC_Build_Log *log, const char *file_path);
+const BCC_Build_Log_Entry *bcc_build_log_lookup(const BCC_Build_Log *log, const char *output_path);
+bool bcc_build_log_record(BCC_Build_Log *log, const char *output_path, BCC_Build_Log_Entry entry);
+bool bcc_build_log_close(BCC_Build_Log *log);
+
+// Fingerprint of the command line
+uint64_t bcc_cmd_hash(BCC_Cmd cmd);
+
+// Hash the content of a file
+bool bcc_hash_file(const char *file_path, uint64_t *hash);
+
+// Fingerprint of the compiler binary: the path it resolves to in $PATH, its size and mtime
+uint64_t bcc_compiler_identity(const char *compiler);
+
+// Fingerprints of whole builds: the compiler identity, the command line and the content of
+// every file in the depfile the command has written. Unlike mtimes they survive checkouts and
+// touching files without changing them. The fingerprint is stored next to the output as
+// `<output_path>.fp`.
+// RETURNS:
+//  0 - the output is still what the command would build
+//  1 - the output, its depfile or its fingerprint is missing, or something has changed
+int bcc_needs_rebuild_fingerprint(const char *output_path, BCC_Cmd cmd, const char *depfile_path);
+bool bcc_fingerprint_store(const char *output_path, BCC_Cmd cmd, const char *depfile_path);
+
+#ifndef BCC_CACHE_DEFAULT_DIR
+#define BCC_CACHE_DEFAULT_DIR "build/cache"
+#endif // BCC_CACHE_DEFAULT_DIR
+
+#ifndef BCC_CACHE_DEFAULT_SIZE
+#define BCC_CACHE_DEFAULT_SIZE (5ULL*1024*1024*1024)
+#endif // BCC_CACHE_DEFAULT_SIZE
+
+// Content addressed object cache, similar to the direct mode of ccache. Lookups are done in
+// two steps:
+//   1. The compiler identity, the command line (without the output and depfile paths), the
+//      working directory and the content of the explicit inputs are hashed into the key of a
+//      manifest. The manifest lists the headers the compile has used last time.
+//   2. That key together with the content of every header of the manifest is the key of the
+//      cached object and its depfile.
+// A hit is restored by a hard link (or a copy if linking fails) instead of running the compiler.
+//
+// The cache can be shared by several builds running at the same time. Every file is written
+// into a temporary file first and renamed into place, so readers never see a partial entry and
+// need no locking. The total size is kept in the `size` file, updated under an exclusive flock
+// of the `lock` file. Once it grows over max_size, the least recently used files (by atime,
+// which is bumped on every hit) are evicted until the cache is below 90% of its budget.
+typedef struct {
+    const char *dir;
+    uint64_t max_size;
+    size_t hits;
+    size_t remote_hits; // Hits that had to be pulled from the remote cache first
+    size_t misses;
+    size_t stores;
+    size_t uploads;
+    size_t evictions;
+} BCC_Cache;
+
+// Directory of the cache according to the options. NULL if caching is disabled
+const char *bcc_cache_dir(void);
+
+// Size budget of the cache according to the options
+uint64_t bcc_cache_max_size(void);
+
+bool bcc_cache_init(BCC_Cache *cache, const char *dir);
+
+// Key of the manifest of a cacheable rule, see BCC_Cache
+bool bcc_cache_manifest_key(const BCC_Rule *rule, uint64_t *key);
+
+// Try to restore the outputs of a cacheable rule from the cache. Returns true on a hit
+bool bcc_cache_fetch(BCC_Cache *cache, const BCC_Rule *rule);
+
+// Put the outputs of a cacheable rule that has just been built into the cache
+bool bcc_cache_store(BCC_Cache *cache, const BCC_Rule *rule);
+
+// Evict the least recently used files until the cache takes at most target_size bytes
+bool bcc_cache_cleanup(BCC_Cache *cache, uint64_t target_size);
+
+void bcc_cache_report(const BCC_Cache *cache);
+
+#ifndef BCC_REMOTE_CACHE_TIMEOUT
+#define BCC_REMOTE_CACHE_TIMEOUT 10 // seconds
+#endif // BCC_REMOTE_CACHE_TIMEOUT
+
+// Largest HTTP body the remote cache sends or accepts. The server answers 413 to anything bigger.
+#ifndef BCC_REMOTE_CACHE_MAX_BODY
+#define BCC_REMOTE_CACHE_MAX_BODY (1ULL*1024*1024*1024)
+#endif // BCC_REMOTE_CACHE_MAX_BODY
+
+// Bytes of the pipelined requests that may wait for their responses at once. It has to stay
+// below what the socket buffers hold, see bcc_http_pipeline.
+#ifndef BCC_REMOTE_CACHE_IN_FLIGHT
+#define BCC_REMOTE_CACHE_IN_FLIGHT (32*1024)
+#endif // BCC_REMOTE_CACHE_IN_FLIGHT
+
+// Remote object cache shared by several machines. It is a plain HTTP server that keeps the
+// files of a BCC_Cache under the same relative paths (`manifests/<key>`, `<xx>/<key>.o`, ...):
+//   GET /<path> - 200 with the content of the file, or 404
+//   PUT /<path> - 201 once the file is stored
+// The local cache is always looked up first. The misses of a build are pulled in batches by
+// a child process (`<program> cache-pull KEY...`) that runs on the job pool next to the
+// compiles, and fresh objects are pushed the same way (`<program> cache-push KEY...`). All the
+// requests of a transfer are pipelined over a single connection, up to BCC_REMOTE_CACHE_IN_FLIGHT.
+// The program has to dispatch those subcommands to bcc_remote_cache_pull and bcc_remote_cache_push.
+
+// URL of the remote cache according to the options. NULL if there is none
+const char *bcc_remote_cache_url(void);
+
+// Download the entries of the given manifest keys (hex) from the remote cache into the local one
+bool bcc_remote_cache_pull(BCC_Cache *cache, const char *url, const char **manifest_keys, size_t count);
+
+// Upload the entries of the given manifest keys (hex) from the local cache to the remote one
+bool bcc_remote_cache_push(BCC_Cache *cache, const char *url, const char **manifest_keys, size_t count);
+
+// Serve the cache in dir over HTTP on address (`PORT` or `HOST:PORT`) until killed. The
+// requests are handled one connection at a time, so it is meant for tests and small teams.
+bool bcc_cache_server(const char *dir, const char *address);
+
 // TODO: add MinGW support for Go Rebuild Urself™ Technology
 #ifndef BCC_REBUILD_URSELF
 #  if _WIN32
 #    if defined(__GNUC__)
-#       define BCC_REBUILD_URSELF(binary_path, source_path) "gcc", "-o", binary_path, source_path
+#       define BCC_REBUILD_URSELF(binary_path, source_path) "gcc", "-o", binary_path, source_path, "-lws2_32"
 #    elif defined(__clang__)
-#       define BCC_REBUILD_URSELF(binary_path, source_path) "clang", "-o", binary_path, source_path
+#       define BCC_REBUILD_URSELF(binary_path, source_path) "clang", "-o", binary_path, source_path, "-lws2_32"
 #    elif defined(_MSC_VER)
 #       define BCC_REBUILD_URSELF(binary_path, source_path) "cl.exe", bcc_temp_sprintf("/Fe:%s", (binary_path)), source_path
 #    endif
@@ -220,6 +844,13 @@ int bcc_file_exists(const char *file_path);
 #  endif
 #endif
 
+// Flags that make BCC_REBUILD_URSELF write a make style depfile, see bcc_needs_rebuild_fingerprint
+#ifndef BCC_REBUILD_URSELF_DEPFILE
+#  if !defined(_MSC_VER) || defined(__clang__)
+#    define BCC_REBUILD_URSELF_DEPFILE(depfile_path) "-MMD", "-MF", depfile_path
+#  endif
+#endif
+
 // Go Rebuild Urself™ Technology
 //
 //   How to use it:
@@ -234,43 +865,66 @@ int bcc_file_exists(const char *file_path);
 //   before doing any actual work. So you only need to bootstrap your build system
 //   once.
 //
-//   The modification is detected by comparing the last modified times of the executable
-//   and its source code. The same way the make utility usually does it.
+//   The modification is detected with a fingerprint of everything the executable has been
+//   built from: the source code, every file it includes (bcc.h, the target files) according
+//   to the depfile of the compiler, the command line and the compiler itself. It is stored
+//   next to the executable as `<binary>.fp`, so touching a file without changing it does not
+//   rebuild anything, and the very first run rebuilds once to create it. Compilers without
+//   make style depfiles (cl.exe) fall back to comparing the last modified times of the
+//   executable and its source code. The same way the make utility usually does it.
 //
 //   The rebuilding is done by using the REBUILD_URSELF macro which you can redefine
 //   if you need a special way of bootstraping your build system. (which I personally
 //   do not recommend since the whole idea of bcc is to keep the process of bootstrapping
 //   as simple as possible and doing all of the actual work inside of the bcc)
 //
+#ifdef BCC_REBUILD_URSELF_DEPFILE
+#define BCC_REBUILD_URSELF_CHECK(rebuild_is_needed, rebuild, binary_path, source_path)       \
+    const char *depfile_path = bcc_temp_sprintf("%s.d", binary_path);                       \
+    bcc_cmd_append(&rebuild, BCC_REBUILD_URSELF(binary_path, source_path),                   \
+                   BCC_REBUILD_URSELF_DEPFILE(depfile_path));                                \
+    int rebuild_is_needed = bcc_needs_rebuild_fingerprint(binary_path, rebuild, depfile_path)
+#define BCC_REBUILD_URSELF_STORE(rebuild, binary_path)                                       \
+    bcc_fingerprint_store(binary_path, rebuild, depfile_path)
+#else
+#define BCC_REBUILD_URSELF_CHECK(rebuild_is_needed, rebuild, binary_path, source_path)       \
+    bcc_cmd_append(&rebuild, BCC_REBUILD_URSELF(binary_path, source_path));                  \
+    int rebuild_is_needed = bcc_needs_rebuild(binary_path, &source_path, 1)
+#define BCC_REBUILD_URSELF_STORE(rebuild, binary_path)
+#endif // BCC_REBUILD_URSELF_DEPFILE
+
 #define BCC_GO_REBUILD_URSELF(argc, argv)                                                    \
     do {                                                                                     \
         const char *source_path = __FILE__;                                                  \
         assert(argc >= 1);                                                                   \
         const char *binary_path = argv[0];                                                   \
                                                                                              \
-        int rebuild_is_needed = bcc_needs_rebuild(binary_path, &source_path, 1);             \
+        BCC_Cmd rebuild = {0};                                                               \
+        BCC_REBUILD_URSELF_CHECK(rebuild_is_needed, rebuild, binary_path, source_path);      \
         if (rebuild_is_needed < 0) exit(1);                                                  \
         if (rebuild_is_needed) {                                                             \
+            bcc_trace_begin("rebuild urself");                                               \
             BCC_String_Builder sb = {0};                                                     \
             bcc_sb_append_cstr(&sb, binary_path);                                            \
             bcc_sb_append_cstr(&sb, ".old");                                                 \
             bcc_sb_append_null(&sb);                                                         \
                                                                                              \
             if (!bcc_rename(binary_path, sb.items)) exit(1);                                 \
-            BCC_Cmd rebuild = {0};                                                           \
-            bcc_cmd_append(&rebuild, BCC_REBUILD_URSELF(binary_path, source_path));          \
             bool rebuild_succeeded = bcc_cmd_run_sync(rebuild);                              \
-            bcc_cmd_free(rebuild);                                                           \
             if (!rebuild_succeeded) {                                                        \
                 bcc_rename(sb.items, binary_path);                                           \
                 exit(1);                                                                     \
             }                                                                                \
+            BCC_REBUILD_URSELF_STORE(rebuild, binary_path);                                  \
+            bcc_cmd_free(rebuild);                                                           \
+            bcc_trace_end();                                                                 \
                                                                                              \
             BCC_Cmd cmd = {0};                                                               \
             bcc_da_append_many(&cmd, argv, argc);                                            \
             if (!bcc_cmd_run_sync(cmd)) exit(1);                                             \
             exit(0);                                                                         \
         }                                                                                    \
+        bcc_cmd_free(rebuild);                                                               \
     } while(0)
 // The implementation idea is stolen from https://github.com/zhiayang/nabs
 
@@ -283,6 +937,8 @@ const char *bcc_temp_sv_to_cstr(BCC_String_View sv);
 
 BCC_String_View bcc_sv_chop_by_delim(BCC_String_View *sv, char delim);
 BCC_String_View bcc_sv_trim(BCC_String_View sv);
+BCC_String_View bcc_sv_trim_left(BCC_String_View sv);
+BCC_String_View bcc_sv_trim_right(BCC_String_View sv);
 bool bcc_sv_eq(BCC_String_View a, BCC_String_View b);
 BCC_String_View bcc_sv_from_cstr(const char *cstr);
 BCC_String_View bcc_sv_from_parts(const char *data, size_t count);
@@ -362,6 +1018,8 @@ static int closedir(DIR *dirp);
 static size_t bcc_temp_size = 0;
 static char bcc_temp[BCC_TEMP_CAPACITY] = {0};
 
+static BCC_Options bcc_options = {0};
+
 bool bcc_mkdir_if_not_exists(const char *path)
 {
 #ifdef _WIN32
@@ -382,9 +1040,9 @@ bool bcc_mkdir_if_not_exists(const char *path)
     return true;
 }
 
-bool bcc_copy_file(const char *src_path, const char *dst_path)
+// Same as bcc_copy_file, but without logging every copy
+static bool bcc_copy_file_quiet(const char *src_path, const char *dst_path)
 {
-    bcc_log(BCC_INFO, "copying %s -> %s", src_path, dst_path);
 #ifdef _WIN32
     if (!CopyFile(src_path, dst_path, FALSE)) {
         bcc_log(BCC_ERROR, "Could not copy file: %lu", GetLastError());
@@ -444,6 +1102,12 @@ defer:
 #endif
 }
 
+bool bcc_copy_file(const char *src_path, const char *dst_path)
+{
+    bcc_log(BCC_INFO, "copying %s -> %s", src_path, dst_path);
+    return bcc_copy_file_quiet(src_path, dst_path);
+}
+
 void bcc_cmd_render(BCC_Cmd cmd, BCC_String_Builder *render)
 {
     for (size_t i = 0; i < cmd.count; ++i) {
@@ -460,7 +1124,41 @@ void bcc_cmd_render(BCC_Cmd cmd, BCC_String_Builder *render)
     }
 }
 
-BCC_Proc bcc_cmd_run_async(BCC_Cmd cmd)
+#ifndef _WIN32
+extern char **environ;
+
+// Start argv, which ends with NULL, with posix_spawnp. Returns -1 on failure. The failure is logged
+static pid_t bcc_spawnp(const char **argv, bool own_group, int output)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    if (output != BCC_INVALID_FD) {
+        posix_spawn_file_actions_adddup2(&actions, output, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, output, STDERR_FILENO);
+    }
+    if (own_group) {
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+
+    pid_t pid = -1;
+    int error = posix_spawnp(&pid, argv[0], &actions, &attr, (char * const*) argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (error != 0) {
+        bcc_log(BCC_ERROR, "Could not spawn child process %s: %s", argv[0], strerror(error));
+        return -1;
+    }
+    return pid;
+}
+#endif // _WIN32
+
+// Same as bcc_cmd_run_async. With own_group the child becomes the leader of a new process
+// group, so everything it starts can be signalled at once, see bcc_jobs_cancel.
+// With an output other than BCC_INVALID_FD the child writes both its stdout and stderr there.
+static BCC_Proc bcc_cmd_spawn(BCC_Cmd cmd, bool own_group, BCC_Fd output)
 {
     if (cmd.count < 1) {
         bcc_log(BCC_ERROR, "Could not run empty command");
@@ -483,8 +1181,8 @@ BCC_Proc bcc_cmd_run_async(BCC_Cmd cmd)
     // NOTE: theoretically setting NULL to std handles should not be a problem
     // https://docs.microsoft.com/en-us/windows/console/getstdhandle?redirectedfrom=MSDN#attachdetach-behavior
     // TODO: check for errors in GetStdHandle
-    siStartInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-    siStartInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    siStartInfo.hStdError = output != BCC_INVALID_FD ? output : GetStdHandle(STD_ERROR_HANDLE);
+    siStartInfo.hStdOutput = output != BCC_INVALID_FD ? output : GetStdHandle(STD_OUTPUT_HANDLE);
     siStartInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
     siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
 
@@ -505,32 +1203,31 @@ BCC_Proc bcc_cmd_run_async(BCC_Cmd cmd)
 
     CloseHandle(piProcInfo.hThread);
 
+    // NOTE: there are no process groups to signal on Windows, the console delivers Ctrl+C to
+    // the children on its own
+    (void) own_group;
+    bcc_trace_proc_start(piProcInfo.hProcess, cmd);
     return piProcInfo.hProcess;
 #else
-    pid_t cpid = fork();
-    if (cpid < 0) {
-        bcc_log(BCC_ERROR, "Could not fork child process: %s", strerror(errno));
-        return BCC_INVALID_PROC;
-    }
-
-    if (cpid == 0) {
-        // NOTE: This leaks a bit of memory in the child process.
-        // But do we actually care? It's a one off leak anyway...
-        BCC_Cmd cmd_null = {0};
-        bcc_da_append_many(&cmd_null, cmd.items, cmd.count);
-        bcc_cmd_append(&cmd_null, NULL);
-
-        if (execvp(cmd.items[0], (char * const*) cmd_null.items) < 0) {
-            bcc_log(BCC_ERROR, "Could not exec child process: %s", strerror(errno));
-            exit(1);
-        }
-        BCC_ASSERT(0 && "unreachable");
-    }
-
+    // NOTE: posix_spawnp is vfork+exec where it matters, so unlike fork it does not copy the
+    // page tables of the whole parent on every command
+    BCC_Cmd cmd_null = {0};
+    bcc_da_append_many(&cmd_null, cmd.items, cmd.count);
+    bcc_cmd_append(&cmd_null, NULL);
+    pid_t cpid = bcc_spawnp(cmd_null.items, own_group, output);
+    bcc_cmd_free(cmd_null);
+    if (cpid < 0) return BCC_INVALID_PROC;
+
+    bcc_trace_proc_start(cpid, cmd);
     return cpid;
 #endif
 }
 
+BCC_Proc bcc_cmd_run_async(BCC_Cmd cmd)
+{
+    return bcc_cmd_spawn(cmd, false, BCC_INVALID_FD);
+}
+
 bool bcc_procs_wait(BCC_Procs procs)
 {
     bool success = true;
@@ -542,6 +1239,44 @@ bool bcc_procs_wait(BCC_Procs procs)
 
 bool bcc_proc_wait(BCC_Proc proc)
 {
+    BCC_Proc_Usage usage;
+    return bcc_proc_wait_usage(proc, &usage);
+}
+
+#ifdef _WIN32
+static void bcc_proc_usage(BCC_Proc proc, BCC_Proc_Usage *usage)
+{
+    FILETIME creation, exit, kernel, user;
+    if (GetProcessTimes(proc, &creation, &exit, &kernel, &user)) {
+        usage->user_us = (((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime)/10;
+        usage->sys_us = (((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)/10;
+    }
+    PROCESS_MEMORY_COUNTERS memory;
+    if (GetProcessMemoryInfo(proc, &memory, sizeof(memory))) usage->max_rss_kb = memory.PeakWorkingSetSize/1024;
+    IO_COUNTERS io;
+    if (GetProcessIoCounters(proc, &io)) {
+        usage->read_ops = io.ReadOperationCount;
+        usage->write_ops = io.WriteOperationCount;
+    }
+}
+#else
+static void bcc_proc_usage(const struct rusage *rusage, BCC_Proc_Usage *usage)
+{
+    usage->user_us = (uint64_t) rusage->ru_utime.tv_sec*1000000 + rusage->ru_utime.tv_usec;
+    usage->sys_us = (uint64_t) rusage->ru_stime.tv_sec*1000000 + rusage->ru_stime.tv_usec;
+#   if defined(__APPLE__)
+    usage->max_rss_kb = rusage->ru_maxrss/1024; // bytes on macOS
+#   else
+    usage->max_rss_kb = rusage->ru_maxrss;
+#   endif
+    usage->read_ops = rusage->ru_inblock;
+    usage->write_ops = rusage->ru_oublock;
+}
+#endif // _WIN32
+
+bool bcc_proc_wait_usage(BCC_Proc proc, BCC_Proc_Usage *usage)
+{
+    memset(usage, 0, sizeof(*usage));
     if (proc == BCC_INVALID_PROC) return false;
 
 #ifdef _WIN32
@@ -560,6 +1295,8 @@ bool bcc_proc_wait(BCC_Proc proc)
         bcc_log(BCC_ERROR, "could not get process exit code: %lu", GetLastError());
         return false;
     }
+    bcc_proc_usage(proc, usage);
+    bcc_trace_proc_end(proc, exit_status, usage);
 
     if (exit_status != 0) {
         bcc_log(BCC_ERROR, "command exited with exit code %lu", exit_status);
@@ -572,13 +1309,16 @@ bool bcc_proc_wait(BCC_Proc proc)
 #else
     for (;;) {
         int wstatus = 0;
-        if (waitpid(proc, &wstatus, 0) < 0) {
+        struct rusage rusage;
+        if (wait4(proc, &wstatus, 0, &rusage) < 0) {
             bcc_log(BCC_ERROR, "could not wait on command (pid %d): %s", proc, strerror(errno));
             return false;
         }
+        bcc_proc_usage(&rusage, usage);
 
         if (WIFEXITED(wstatus)) {
             int exit_status = WEXITSTATUS(wstatus);
+            bcc_trace_proc_end(proc, exit_status, usage);
             if (exit_status != 0) {
                 bcc_log(BCC_ERROR, "command exited with exit code %d", exit_status);
                 return false;
@@ -588,6 +1328,8 @@ bool bcc_proc_wait(BCC_Proc proc)
         }
 
         if (WIFSIGNALED(wstatus)) {
+            // NOTE: the same exit code a shell would report
+            bcc_trace_proc_end(proc, 128 + WTERMSIG(wstatus), usage);
             bcc_log(BCC_ERROR, "command process was terminated by %s", strsignal(WTERMSIG(wstatus)));
             return false;
         }
@@ -603,457 +1345,5361 @@ bool bcc_cmd_run_sync(BCC_Cmd cmd)
     if (p == BCC_INVALID_PROC) return false;
     return bcc_proc_wait(p);
 }
-char *bcc_shift_args(int *argc, char ***argv)
+
+bool bcc_bench_spawn(size_t count, size_t ballast_mb)
 {
-    BCC_ASSERT(*argc > 0);
-    char *result = **argv;
-    (*argv) += 1;
-    (*argc) -= 1;
-    return result;
-}
+#ifdef _WIN32
+    (void) count;
+    (void) ballast_mb;
+    bcc_log(BCC_ERROR, "bench-spawn compares fork with posix_spawn, there is neither on Windows");
+    return false;
+#else
+    bool result = true;
+    char *ballast = malloc(ballast_mb*1024*1024);
+    BCC_ASSERT((ballast != NULL || ballast_mb == 0) && "Buy more RAM lol");
+    // Touch every page, the untouched ones are not mapped yet and cost fork nothing
+    memset(ballast, 1, ballast_mb*1024*1024);
+
+    const char *argv[] = {"true", NULL};
+    const char *methods[] = {"fork+execvp", "posix_spawnp"};
+    uint64_t elapsed[2] = {0};
+    for (size_t method = 0; method < 2; ++method) {
+        uint64_t start = bcc_trace_now();
+        for (size_t i = 0; i < count; ++i) {
+            pid_t pid = -1;
+            if (method == 0) {
+                pid = fork();
+                if (pid == 0) {
+                    execvp(argv[0], (char * const*) argv);
+                    _exit(127);
+                }
+                if (pid < 0) bcc_log(BCC_ERROR, "Could not fork child process: %s", strerror(errno));
+            } else {
+                pid = bcc_spawnp(argv, false, BCC_INVALID_FD);
+            }
+            if (pid < 0) bcc_return_defer(false);
 
+            int wstatus = 0;
+            while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR);
+            if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+                bcc_log(BCC_ERROR, "%s: `%s` has failed", methods[method], argv[0]);
+                bcc_return_defer(false);
+            }
+        }
+        elapsed[method] = bcc_trace_now() - start;
+    }
 
-void bcc_log(BCC_Log_Level level, const char *fmt, ...)
-{
-    switch (level) {
-    case BCC_INFO:
-        fprintf(stderr, "[INFO] ");
-        break;
-    case BCC_WARNING:
-        fprintf(stderr, "[WARNING] ");
-        break;
-    case BCC_ERROR:
-        fprintf(stderr, "[ERROR] ");
-        break;
-    default:
-        BCC_ASSERT(0 && "unreachable");
+    bcc_log(BCC_INFO, "%zu spawns of `%s` with %zuMB of ballast", count, argv[0], ballast_mb);
+    for (size_t method = 0; method < 2; ++method) {
+        double secs = elapsed[method]/1e6;
+        bcc_log(BCC_INFO, "%14s: %8.3fs %10.0f spawns/s", methods[method], secs, secs > 0 ? count/secs : 0.0);
     }
 
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    va_end(args);
-    fprintf(stderr, "\n");
+defer:
+    free(ballast);
+    return result;
+#endif // _WIN32
 }
 
-bool bcc_read_entire_dir(const char *parent, BCC_File_Paths *children)
+bool bcc_parse_options(int argc, char **argv)
 {
-    bool result = true;
-    DIR *dir = NULL;
+    for (int i = 0; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (arg[0] != '-') {
+            bcc_da_append(&bcc_options.args, arg);
+            continue;
+        }
 
-    dir = opendir(parent);
-    if (dir == NULL) {
-        bcc_log(BCC_ERROR, "Could not open directory %s: %s", parent, strerror(errno));
-        bcc_return_defer(false);
+        if (strncmp(arg, "-j", 2) == 0) {
+            const char *value = arg + 2;
+            if (*value == '\0') {
+                if (i + 1 >= argc) {
+                    bcc_log(BCC_ERROR, "-j expects the number of jobs");
+                    return false;
+                }
+                value = argv[++i];
+            }
+            char *end = NULL;
+            long n = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || n <= 0) {
+                bcc_log(BCC_ERROR, "invalid number of jobs `%s`", value);
+                return false;
+            }
+            bcc_options.max_jobs = n;
+        } else if (strncmp(arg, "--cache-dir=", 12) == 0) {
+            bcc_options.cache_dir = arg + 12;
+        } else if (strcmp(arg, "--no-cache") == 0) {
+            bcc_options.no_cache = true;
+        } else if (strncmp(arg, "--remote-cache=", 15) == 0) {
+            bcc_options.remote_cache = arg + 15;
+        } else if (strncmp(arg, "--mem-budget=", 13) == 0) {
+            if (!bcc_parse_size(arg + 13, &bcc_options.mem_budget)) {
+                bcc_log(BCC_ERROR, "invalid memory budget `%s`", arg + 13);
+                return false;
+            }
+        } else if (strcmp(arg, "--keep-going") == 0) {
+            bcc_options.keep_going = true;
+        } else if (strncmp(arg, "--changes=", 10) == 0) {
+            if (strcmp(arg + 10, "mtime") == 0) {
+                bcc_options.changes = BCC_CHANGES_MTIME;
+            } else if (strcmp(arg + 10, "hash") == 0) {
+                bcc_options.changes = BCC_CHANGES_HASH;
+            } else {
+                bcc_log(BCC_ERROR, "unknown change detection `%s`, expected mtime or hash", arg + 10);
+                return false;
+            }
+        } else if (strncmp(arg, "--linker=", 9) == 0) {
+            static const char *linkers[] = { BCC_LINKERS, "auto" };
+            size_t k = 0;
+            while (k < BCC_ARRAY_LEN(linkers) && strcmp(arg + 9, linkers[k]) != 0) k += 1;
+            if (k == BCC_ARRAY_LEN(linkers)) {
+                bcc_log(BCC_ERROR, "unknown linker `%s`, expected bfd, gold, lld, mold or auto", arg + 9);
+                return false;
+            }
+            bcc_options.linker = arg + 9;
+        } else if (strcmp(arg, "--unity") == 0) {
+            bcc_options.unity = true;
+        } else if (strncmp(arg, "--unity=", 8) == 0) {
+            char *end = NULL;
+            long n = strtol(arg + 8, &end, 10);
+            if (arg[8] == '\0' || *end != '\0' || n <= 0) {
+                bcc_log(BCC_ERROR, "invalid number of unity groups `%s`", arg + 8);
+                return false;
+            }
+            bcc_options.unity = true;
+            bcc_options.unity_groups = n;
+        } else if (strncmp(arg, "--cache-size=", 13) == 0) {
+            if (!bcc_parse_size(arg + 13, &bcc_options.cache_size)) {
+                bcc_log(BCC_ERROR, "invalid cache size `%s`", arg + 13);
+                return false;
+            }
+        } else {
+            bcc_log(BCC_ERROR, "unknown option `%s`", arg);
+            return false;
+        }
     }
+    return true;
+}
 
+bool bcc_parse_size(const char *cstr, uint64_t *size)
+{
+    // NOTE: strtoull skips spaces and negates "-5" into a huge size, so only digits may come first
+    if (!isdigit((unsigned char) *cstr)) return false;
+    char *end = NULL;
     errno = 0;
-    struct dirent *ent = readdir(dir);
-    while (ent != NULL) {
-        bcc_da_append(children, bcc_temp_strdup(ent->d_name));
-        ent = readdir(dir);
+    unsigned long long n = strtoull(cstr, &end, 10);
+    if (errno == ERANGE || n == 0) return false;
+    int shift = 0;
+    switch (*end) {
+        case 'K': case 'k': shift = 10; end += 1; break;
+        case 'M': case 'm': shift = 20; end += 1; break;
+        case 'G': case 'g': shift = 30; end += 1; break;
+        default: break;
     }
+    if (*end != '\0') return false;
+    if (n > (UINT64_MAX >> shift)) return false;
+    *size = (uint64_t) n << shift;
+    return true;
+}
 
-    if (errno != 0) {
-        bcc_log(BCC_ERROR, "Could not read directory %s: %s", parent, strerror(errno));
-        bcc_return_defer(false);
-    }
+size_t bcc_nprocs(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) return 1;
+    return n;
+#endif // _WIN32
+}
 
-defer:
-    if (dir) closedir(dir);
-    return result;
+size_t bcc_max_jobs(void)
+{
+    size_t n = bcc_options.max_jobs;
+    if (n == 0) n = bcc_nprocs();
+#ifdef _WIN32
+    // WaitForMultipleObjects can not wait on more handles than that
+    if (n > MAXIMUM_WAIT_OBJECTS) n = MAXIMUM_WAIT_OBJECTS;
+#endif // _WIN32
+    return n;
 }
 
-bool bcc_write_entire_file(const char *path, const void *data, size_t size)
+void bcc_jobs_push(BCC_Jobs *jobs, BCC_Cmd cmd)
 {
-    bool result = true;
+    BCC_Job job = {0};
+    bcc_da_append_many(&job.cmd, cmd.items, cmd.count);
+    job.proc = BCC_INVALID_PROC;
+    job.tag = jobs->queued.count;
+    bcc_da_append(&jobs->queued, job);
+}
 
-    FILE *f = fopen(path, "wb");
-    if (f == NULL) {
-        bcc_log(BCC_ERROR, "Could not open file %s for writing: %s\n", path, strerror(errno));
-        bcc_return_defer(false);
-    }
+#ifdef _WIN32
+#define BCC_JOBSERVER_INVALID NULL
+#else
+#define BCC_JOBSERVER_INVALID (-1)
+#endif // _WIN32
 
-    //           len
-    //           v
-    // aaaaaaaaaa
-    //     ^
-    //     data
+static struct {
+    bool initialized;
+#ifdef _WIN32
+    HANDLE semaphore;
+#else
+    int read_fd;      // Non blocking unless read_blocking
+    int write_fd;
+    bool read_blocking;
+#endif // _WIN32
+    BCC_String_Builder tokens; // The tokens that have been taken, they have to go back as they were
+} bcc_jobserver = {0};
 
-    const char *buf = data;
-    while (size > 0) {
-        size_t n = fwrite(buf, 1, size, f);
-        if (ferror(f)) {
-            bcc_log(BCC_ERROR, "Could not write into file %s: %s\n", path, strerror(errno));
-            bcc_return_defer(false);
-        }
-        size -= n;
-        buf  += n;
+static bool bcc_jobserver_connect(const char *auth)
+{
+#ifdef _WIN32
+    size_t name_len = strcspn(auth, " ");
+    const char *name = bcc_temp_sv_to_cstr(bcc_sv_from_parts(auth, name_len));
+    bcc_jobserver.semaphore = OpenSemaphoreA(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, name);
+    return bcc_jobserver.semaphore != NULL;
+#else
+    if (strncmp(auth, "fifo:", 5) == 0) {
+        size_t path_len = strcspn(auth + 5, " ");
+        const char *path = bcc_temp_sv_to_cstr(bcc_sv_from_parts(auth + 5, path_len));
+        int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) return false;
+        bcc_jobserver.read_fd = fd;
+        bcc_jobserver.write_fd = fd;
+        return true;
     }
 
-defer:
-    if (f) fclose(f);
-    return result;
+    int read_fd = -1;
+    int write_fd = -1;
+    if (sscanf(auth, "%d,%d", &read_fd, &write_fd) != 2) return false;
+    // NOTE: make does not pass the pipe down to commands that are not marked with `+`
+    if (fcntl(read_fd, F_GETFD) < 0 || fcntl(write_fd, F_GETFD) < 0) return false;
+
+    // NOTE: O_NONBLOCK on the inherited descriptor would apply to every process that shares
+    // the pipe and break their blocking reads. A descriptor of our own does not have that
+    // problem, but it can only be opened through /proc.
+    int fd = open(bcc_temp_sprintf("/proc/self/fd/%d", read_fd), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    bcc_jobserver.read_blocking = fd < 0;
+    bcc_jobserver.read_fd = fd < 0 ? read_fd : fd;
+    bcc_jobserver.write_fd = write_fd;
+    return true;
+#endif // _WIN32
 }
 
-BCC_File_Type bcc_get_file_type(const char *path)
+static bool bcc_jobserver_serve(size_t slots)
 {
+    const char *makeflags = getenv("MAKEFLAGS");
+    if (makeflags == NULL) makeflags = "";
 #ifdef _WIN32
-    DWORD attr = GetFileAttributesA(path);
-    if (attr == INVALID_FILE_ATTRIBUTES) {
-        bcc_log(BCC_ERROR, "Could not get file attributes of %s: %lu", path, GetLastError());
-        return -1;
+    const char *name = bcc_temp_sprintf("bcc_jobserver_%lu", GetCurrentProcessId());
+    bcc_jobserver.semaphore = CreateSemaphoreA(NULL, (LONG)slots - 1, (LONG)slots, name);
+    if (bcc_jobserver.semaphore == NULL) {
+        bcc_log(BCC_WARNING, "could not create the jobserver semaphore: %lu", GetLastError());
+        return false;
     }
-
+    _putenv_s("MAKEFLAGS", bcc_temp_sprintf("%s -j%zu --jobserver-auth=%s", makeflags, slots, name));
+#else
+    // NOTE: the pipe is inherited by every command on purpose, that is how they get to it
+    int fds[2];
+    if (pipe(fds) < 0) {
+        bcc_log(BCC_WARNING, "could not create the jobserver pipe: %s", strerror(errno));
+        return false;
+    }
+    for (size_t i = 1; i < slots; ++i) {
+        if (write(fds[1], "+", 1) != 1) {
+            bcc_log(BCC_WARNING, "could not fill the jobserver pipe: %s", strerror(errno));
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+    }
+    // --jobserver-fds is for the tools that predate --jobserver-auth
+    const char *auth = bcc_temp_sprintf("%d,%d", fds[0], fds[1]);
+    setenv("MAKEFLAGS", bcc_temp_sprintf("%s -j%zu --jobserver-fds=%s --jobserver-auth=%s", makeflags, slots, auth, auth), 1);
+    if (!bcc_jobserver_connect(auth)) return false;
+#endif // _WIN32
+    return true;
+}
+
+void bcc_jobserver_init(void)
+{
+    if (bcc_jobserver.initialized) return;
+    bcc_jobserver.initialized = true;
+#ifdef _WIN32
+    bcc_jobserver.semaphore = BCC_JOBSERVER_INVALID;
+#else
+    bcc_jobserver.read_fd = BCC_JOBSERVER_INVALID;
+    bcc_jobserver.write_fd = BCC_JOBSERVER_INVALID;
+#endif // _WIN32
+
+    size_t temp_checkpoint = bcc_temp_save();
+    // NOTE: the last one wins, every nested make appends its own
+    const char *makeflags = getenv("MAKEFLAGS");
+    const char *auth = NULL;
+    for (const char *p = makeflags; p != NULL && (p = strstr(p, "--jobserver-")) != NULL; p += 1) {
+        if (strncmp(p, "--jobserver-auth=", 17) == 0) auth = p + 17;
+        if (strncmp(p, "--jobserver-fds=", 16) == 0) auth = p + 16;
+    }
+
+    if (auth != NULL) {
+        // Same as make in that case, only the implicit token is left to run on
+        if (!bcc_jobserver_connect(auth)) bcc_log(BCC_WARNING, "jobserver unavailable: using -j1. Add `+` to the parent make rule.");
+    } else {
+        bcc_jobserver_serve(bcc_max_jobs());
+    }
+    bcc_temp_rewind(temp_checkpoint);
+}
+
+bool bcc_jobserver_acquire(void)
+{
+    bcc_jobserver_init();
+    char token = '+';
+#ifdef _WIN32
+    if (bcc_jobserver.semaphore == BCC_JOBSERVER_INVALID) return false;
+    if (WaitForSingleObject(bcc_jobserver.semaphore, 0) != WAIT_OBJECT_0) return false;
+#else
+    if (bcc_jobserver.read_fd == BCC_JOBSERVER_INVALID) return false;
+    if (bcc_jobserver.read_blocking) {
+        // NOTE: someone else may still take the token in between the poll and the read, but
+        // there is no better way to tell without /proc
+        struct pollfd pfd = { .fd = bcc_jobserver.read_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 0) <= 0) return false;
+    }
+    if (read(bcc_jobserver.read_fd, &token, 1) != 1) return false;
+#endif // _WIN32
+    bcc_da_append(&bcc_jobserver.tokens, token);
+    return true;
+}
+
+void bcc_jobserver_release(void)
+{
+    BCC_ASSERT(bcc_jobserver.tokens.count > 0);
+    char token = bcc_jobserver.tokens.items[--bcc_jobserver.tokens.count];
+#ifdef _WIN32
+    (void) token;
+    ReleaseSemaphore(bcc_jobserver.semaphore, 1, NULL);
+#else
+    while (write(bcc_jobserver.write_fd, &token, 1) < 0 && errno == EINTR);
+#endif // _WIN32
+}
+
+// Give back the tokens the running jobs do not need anymore. The first job runs on the
+// implicit token of the process.
+static void bcc_jobs_release_tokens(BCC_Jobs *jobs)
+{
+    size_t needed = jobs->running.count > 0 ? jobs->running.count - 1 : 0;
+    while (jobs->tokens > needed) {
+        bcc_jobserver_release();
+        jobs->tokens -= 1;
+    }
+}
+
+static bool bcc_jobs_below_max(BCC_Jobs *jobs)
+{
+    size_t max_jobs = jobs->max_jobs ? jobs->max_jobs : bcc_max_jobs();
+    return jobs->running.count < max_jobs;
+}
+
+bool bcc_jobs_has_free_slot(BCC_Jobs *jobs)
+{
+    bcc_jobserver_init();
+    if (!bcc_jobs_below_max(jobs)) return false;
+    if (jobs->running.count <= jobs->tokens) return true;
+    if (bcc_jobserver_acquire()) {
+        jobs->tokens += 1;
+        return true;
+    }
+    jobs->wants_token = true;
+    return false;
+}
+
+uint64_t bcc_available_memory_kb(void)
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status)) return 0;
+    return status.ullAvailPhys/1024;
+#else
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (meminfo != NULL) {
+        char line[256];
+        unsigned long long kb = 0;
+        bool found = false;
+        while (!found && fgets(line, sizeof(line), meminfo)) {
+            found = sscanf(line, "MemAvailable: %llu kB", &kb) == 1;
+        }
+        fclose(meminfo);
+        if (found) return kb;
+    }
+#   ifdef _SC_AVPHYS_PAGES
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+#   else
+    // NOTE: no cheap way to tell the available memory on macOS, the total has to do
+    long pages = sysconf(_SC_PHYS_PAGES);
+#   endif
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) return 0;
+    return (uint64_t) pages*page_size/1024;
+#endif // _WIN32
+}
+
+uint64_t bcc_mem_budget_kb(void)
+{
+    if (bcc_options.mem_budget) return bcc_options.mem_budget/1024;
+    const char *env = getenv("BCC_MEM_BUDGET");
+    if (env && *env) {
+        uint64_t size = 0;
+        if (bcc_parse_size(env, &size)) return size/1024;
+        bcc_log(BCC_WARNING, "invalid BCC_MEM_BUDGET `%s`", env);
+    }
+    uint64_t available = bcc_available_memory_kb();
+    return available > 0 ? available : UINT64_MAX;
+}
+
+bool bcc_jobs_has_room(BCC_Jobs *jobs, uint64_t mem_kb)
+{
+    if (!bcc_jobs_below_max(jobs)) return false;
+    if (jobs->running.count == 0 || mem_kb == 0) return true;
+    return jobs->mem_used_kb + mem_kb <= jobs->mem_budget_kb;
+}
+
+bool bcc_jobs_start(BCC_Jobs *jobs, BCC_Cmd cmd, size_t tag)
+{
+    return bcc_jobs_start_mem(jobs, cmd, tag, 0);
+}
+
+#ifndef _WIN32
+// Jobs running across all the pools. The signal handlers are only there while it is not 0
+static size_t bcc_jobs_live = 0;
+static volatile sig_atomic_t bcc_jobs_signal = 0;
+static struct sigaction bcc_jobs_old_sigint;
+static struct sigaction bcc_jobs_old_sigterm;
+
+static void bcc_jobs_on_signal(int sig)
+{
+    bcc_jobs_signal = sig;
+}
+#endif // _WIN32
+
+// Track the jobs that are started and finished. The jobs live in process groups of their own
+// where the terminal's Ctrl+C does not get to, so bcc catches it for them in the meantime.
+static void bcc_jobs_track(int delta)
+{
+#ifdef _WIN32
+    (void) delta;
+#else
+    if (delta > 0 && bcc_jobs_live++ == 0) {
+        struct sigaction action = {0};
+        action.sa_handler = bcc_jobs_on_signal;
+        sigemptyset(&action.sa_mask);
+        // NOTE: no SA_RESTART, the blocking wait4 of bcc_jobs_reap has to be interrupted
+        action.sa_flags = 0;
+        sigaction(SIGINT, &action, &bcc_jobs_old_sigint);
+        sigaction(SIGTERM, &action, &bcc_jobs_old_sigterm);
+    }
+    if (delta < 0 && --bcc_jobs_live == 0) {
+        sigaction(SIGINT, &bcc_jobs_old_sigint, NULL);
+        sigaction(SIGTERM, &bcc_jobs_old_sigterm, NULL);
+    }
+#endif // _WIN32
+}
+
+// Create the place the job writes its output into. `write_fd` is what the child gets, the
+// parent closes it once the child has been started.
+static bool bcc_job_output_open(BCC_Job *job, BCC_Fd *write_fd)
+{
+#ifdef _WIN32
+    // NOTE: anonymous pipes can not be waited on together with the processes, so the output
+    // goes into a temporary file that is read once the job has finished
+    char dir[MAX_PATH];
+    char path[MAX_PATH];
+    if (GetTempPathA(sizeof(dir), dir) == 0 || GetTempFileNameA(dir, "bcc", 0, path) == 0) return false;
+    job->output_fd = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (job->output_fd == INVALID_HANDLE_VALUE) return false;
+    if (!DuplicateHandle(GetCurrentProcess(), job->output_fd, GetCurrentProcess(), write_fd, 0, TRUE, DUPLICATE_SAME_ACCESS)) {
+        CloseHandle(job->output_fd);
+        job->output_fd = BCC_INVALID_FD;
+        return false;
+    }
+    return true;
+#else
+    int fds[2];
+    if (pipe(fds) < 0) return false;
+    // NOTE: no other child may get the write end. The end of the output is only seen once
+    // every process that has it is gone.
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    job->output_fd = fds[0];
+    *write_fd = fds[1];
+    return true;
+#endif // _WIN32
+}
+
+static void bcc_job_output_append(BCC_Job *job, const char *data, size_t size)
+{
+    if (job->output_spill == NULL && job->output.count + size > BCC_JOB_OUTPUT_CAP) {
+        job->output_spill = tmpfile();
+        if (job->output_spill == NULL) bcc_log(BCC_WARNING, "could not create a temporary file for the output of a job: %s", strerror(errno));
+    }
+    if (job->output_spill != NULL) {
+        fwrite(data, 1, size, job->output_spill);
+    } else {
+        bcc_sb_append_buf(&job->output, data, size);
+    }
+}
+
+#ifndef _WIN32
+// Read what the job has written into its pipe so far. The pipe is closed once all of the
+// output is there.
+static void bcc_job_output_read(BCC_Job *job)
+{
+    char chunk[4096];
+    for (;;) {
+        ssize_t n = read(job->output_fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) break;
+        bcc_job_output_append(job, chunk, n);
+    }
+    close(job->output_fd);
+    job->output_fd = BCC_INVALID_FD;
+}
+#endif // _WIN32
+
+static void bcc_job_output_discard(BCC_Job *job)
+{
+    if (job->output_fd != BCC_INVALID_FD) {
+#ifdef _WIN32
+        CloseHandle(job->output_fd);
+#else
+        close(job->output_fd);
+#endif // _WIN32
+        job->output_fd = BCC_INVALID_FD;
+    }
+    if (job->output_spill != NULL) fclose(job->output_spill);
+    job->output_spill = NULL;
+    bcc_sb_free(job->output);
+    memset(&job->output, 0, sizeof(job->output));
+}
+
+// Print the whole output of a finished job at once
+static void bcc_job_output_print(BCC_Job *job)
+{
+    char chunk[4096];
+#ifdef _WIN32
+    if (job->output_fd != BCC_INVALID_FD) {
+        SetFilePointer(job->output_fd, 0, NULL, FILE_BEGIN);
+        DWORD n = 0;
+        while (ReadFile(job->output_fd, chunk, sizeof(chunk), &n, NULL) && n > 0) bcc_job_output_append(job, chunk, n);
+    }
+#else
+    // NOTE: a process the job has left behind may still hold the pipe. Its output is lost,
+    // there is no waiting for it.
+    if (job->output_fd != BCC_INVALID_FD) bcc_job_output_read(job);
+#endif // _WIN32
+
+    fflush(stdout);
+    if (job->output.count > 0) fwrite(job->output.items, 1, job->output.count, stderr);
+    if (job->output_spill != NULL) {
+        rewind(job->output_spill);
+        size_t n = 0;
+        while ((n = fread(chunk, 1, sizeof(chunk), job->output_spill)) > 0) fwrite(chunk, 1, n, stderr);
+    }
+    fflush(stderr);
+    bcc_job_output_discard(job);
+}
+
+bool bcc_jobs_start_mem(BCC_Jobs *jobs, BCC_Cmd cmd, size_t tag, uint64_t mem_kb)
+{
+    // NOTE: the available memory is only what the budget is while none of the jobs has taken
+    // any of it yet, later they would be counted twice
+    if (jobs->mem_budget_kb == 0 && jobs->running.count == 0) jobs->mem_budget_kb = bcc_mem_budget_kb();
+    BCC_Job job = {0};
+    job.output_fd = BCC_INVALID_FD;
+    BCC_Fd write_fd = BCC_INVALID_FD;
+    if (!bcc_job_output_open(&job, &write_fd)) bcc_log(BCC_WARNING, "could not capture the output of a job, it goes straight to the terminal");
+    job.proc = bcc_cmd_spawn(cmd, true, write_fd);
+    if (write_fd != BCC_INVALID_FD) {
+#ifdef _WIN32
+        CloseHandle(write_fd);
+#else
+        close(write_fd);
+#endif // _WIN32
+    }
+    if (job.proc == BCC_INVALID_PROC) {
+        bcc_job_output_discard(&job);
+        return false;
+    }
+    bcc_jobs_track(1);
+    bcc_da_append_many(&job.cmd, cmd.items, cmd.count);
+    job.tag = tag;
+
+    // Lowest slot that is not taken by any of the running jobs
+    for (bool taken = true; taken; ) {
+        taken = false;
+        for (size_t i = 0; i < jobs->running.count && !taken; ++i) {
+            if (jobs->running.items[i].slot == job.slot) {
+                taken = true;
+                job.slot += 1;
+            }
+        }
+    }
+    bcc_trace_proc_slot(job.proc, job.slot);
+    job.mem_kb = mem_kb;
+    jobs->mem_used_kb += mem_kb;
+    bcc_da_append(&jobs->running, job);
+    return true;
+}
+
+// The reap has woken up for a jobserver token, not for a job
+static bool bcc_jobs_reap_token(BCC_Jobs *jobs, BCC_Job *job)
+{
+    jobs->tokens += 1;
+    jobs->wants_token = false;
+    memset(job, 0, sizeof(*job));
+    job->proc = BCC_INVALID_PROC;
+    return true;
+}
+
+bool bcc_jobs_reap(BCC_Jobs *jobs, BCC_Job *job, bool *ok)
+{
+    if (jobs->running.count == 0) return false;
+    bcc_jobs_release_tokens(jobs);
+
+    size_t index = 0;
+#ifdef _WIN32
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    BCC_ASSERT(jobs->running.count <= MAXIMUM_WAIT_OBJECTS);
+    for (size_t i = 0; i < jobs->running.count; ++i) {
+        handles[i] = jobs->running.items[i].proc;
+    }
+    size_t handles_count = jobs->running.count;
+    if (jobs->wants_token && bcc_jobserver.semaphore != BCC_JOBSERVER_INVALID && handles_count < MAXIMUM_WAIT_OBJECTS) {
+        handles[handles_count++] = bcc_jobserver.semaphore;
+    }
+
+    DWORD result = WaitForMultipleObjects(handles_count, handles, FALSE, INFINITE);
+    if (result == WAIT_FAILED || result >= WAIT_OBJECT_0 + handles_count) {
+        bcc_log(BCC_ERROR, "could not wait on child processes: %lu", GetLastError());
+        return false;
+    }
+    index = result - WAIT_OBJECT_0;
+    if (index == jobs->running.count) {
+        // NOTE: the wait has already taken the token from the semaphore
+        bcc_da_append(&bcc_jobserver.tokens, '+');
+        return bcc_jobs_reap_token(jobs, job);
+    }
+    // The process has already finished, so this only collects its exit code
+    bcc_job_output_print(&jobs->running.items[index]);
+    *ok = bcc_proc_wait_usage(jobs->running.items[index].proc, &jobs->running.items[index].usage);
+#else
+    for (;;) {
+        // NOTE: a signal that comes in between this check and wait4 is only noticed once
+        // any of the jobs has finished
+        if (bcc_jobs_signal != 0) {
+            bcc_log(BCC_ERROR, "interrupted by %s, cancelling the running jobs", strsignal(bcc_jobs_signal));
+            bcc_jobs_signal = 0;
+            bcc_jobs_cancel(jobs);
+            jobs->interrupted = true;
+            return false;
+        }
+
+        int wstatus = 0;
+        struct rusage rusage;
+        pid_t pid = wait4(-1, &wstatus, WNOHANG, &rusage);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            bcc_log(BCC_ERROR, "could not wait on child processes: %s", strerror(errno));
+            return false;
+        }
+        if (pid == 0) {
+            // Wait for the output of the jobs and the jobserver. The pipe of a job is closed
+            // once it has exited, that is what wakes the poll up.
+            // NOTE: there is no way to wait for a child and a file descriptor at the same
+            // time, so the jobs without a pipe are checked every few milliseconds in between.
+            // The others are checked every now and then too: a process a job has left behind
+            // keeps its pipe open after the job has exited.
+            // NOTE: not from the temporary allocator, it does not align anything
+            struct pollfd *fds = malloc(sizeof(*fds)*(jobs->running.count + 1));
+            BCC_ASSERT(fds != NULL && "Buy more RAM lol");
+            size_t fds_count = 0;
+            bool unwatched = false;
+            for (size_t i = 0; i < jobs->running.count; ++i) {
+                if (jobs->running.items[i].output_fd == BCC_INVALID_FD) {
+                    unwatched = true;
+                    continue;
+                }
+                fds[fds_count++] = (struct pollfd) { .fd = jobs->running.items[i].output_fd, .events = POLLIN };
+            }
+            bool poll_jobserver = jobs->wants_token && bcc_jobserver.read_fd != BCC_JOBSERVER_INVALID;
+            if (poll_jobserver) fds[fds_count++] = (struct pollfd) { .fd = bcc_jobserver.read_fd, .events = POLLIN };
+
+            if (fds_count > 0) {
+                int ready = poll(fds, fds_count, unwatched ? 10 : 100);
+                bool token = false;
+                for (size_t i = 0; ready > 0 && i < fds_count; ++i) {
+                    if (fds[i].revents == 0) continue;
+                    if (poll_jobserver && i == fds_count - 1) {
+                        token = bcc_jobserver_acquire();
+                        continue;
+                    }
+                    for (size_t j = 0; j < jobs->running.count; ++j) {
+                        if (jobs->running.items[j].output_fd == fds[i].fd) bcc_job_output_read(&jobs->running.items[j]);
+                    }
+                }
+                free(fds);
+                if (token) return bcc_jobs_reap_token(jobs, job);
+                continue;
+            }
+            free(fds);
+
+            pid = wait4(-1, &wstatus, 0, &rusage);
+            if (pid < 0) {
+                if (errno == EINTR) continue;
+                bcc_log(BCC_ERROR, "could not wait on child processes: %s", strerror(errno));
+                return false;
+            }
+        }
+
+        for (index = 0; index < jobs->running.count; ++index) {
+            if (jobs->running.items[index].proc == pid) break;
+        }
+        if (index >= jobs->running.count) {
+            bcc_log(BCC_WARNING, "reaped unknown child process (pid %d)", pid);
+            continue;
+        }
+        bcc_job_output_print(&jobs->running.items[index]);
+
+        *ok = false;
+        BCC_Proc_Usage *usage = &jobs->running.items[index].usage;
+        bcc_proc_usage(&rusage, usage);
+        bcc_trace_proc_end(pid, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus), usage);
+        if (WIFEXITED(wstatus)) {
+            int exit_status = WEXITSTATUS(wstatus);
+            if (exit_status != 0) {
+                bcc_log(BCC_ERROR, "command exited with exit code %d", exit_status);
+            } else {
+                *ok = true;
+            }
+        } else if (WIFSIGNALED(wstatus)) {
+            bcc_log(BCC_ERROR, "command process was terminated by %s", strsignal(WTERMSIG(wstatus)));
+        }
+        break;
+    }
+#endif // _WIN32
+
+    *job = jobs->running.items[index];
+    jobs->running.items[index] = jobs->running.items[--jobs->running.count];
+    jobs->mem_used_kb -= job->mem_kb;
+    jobs->wants_token = false;
+    bcc_jobs_release_tokens(jobs);
+    bcc_jobs_track(-1);
+    return true;
+}
+
+void bcc_jobs_cancel(BCC_Jobs *jobs)
+{
+    if (jobs->running.count > 0) bcc_log(BCC_INFO, "cancelling %zu running jobs", jobs->running.count);
+    for (size_t i = 0; i < jobs->running.count; ++i) {
+#ifdef _WIN32
+        TerminateProcess(jobs->running.items[i].proc, 1);
+#else
+        kill(-jobs->running.items[i].proc, SIGTERM);
+#endif // _WIN32
+    }
+
+#ifndef _WIN32
+    // NOTE: a job may ignore or handle SIGTERM. It gets a moment to finish, then it is killed
+    // together with its group, so the cancel does not wait for it to run to the end.
+    size_t left = jobs->running.count;
+    uint64_t deadline = bcc_trace_now() + BCC_JOBS_CANCEL_GRACE_MS*1000;
+    for (bool killed = false; left > 0; ) {
+        for (size_t i = 0; i < jobs->running.count; ++i) {
+            BCC_Job *job = &jobs->running.items[i];
+            if (job->proc == BCC_INVALID_PROC) continue;
+            int wstatus = 0;
+            struct rusage rusage;
+            pid_t pid = 0;
+            while ((pid = wait4(job->proc, &wstatus, killed ? 0 : WNOHANG, &rusage)) < 0 && errno == EINTR);
+            if (pid == 0) continue;
+            if (pid == job->proc) {
+                bcc_proc_usage(&rusage, &job->usage);
+                bcc_trace_proc_end(job->proc, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus), &job->usage);
+            }
+            job->proc = BCC_INVALID_PROC;
+            left -= 1;
+        }
+        if (left == 0 || killed) break;
+        if (bcc_trace_now() < deadline) {
+            poll(NULL, 0, 1);
+            continue;
+        }
+        for (size_t i = 0; i < jobs->running.count; ++i) {
+            if (jobs->running.items[i].proc != BCC_INVALID_PROC) kill(-jobs->running.items[i].proc, SIGKILL);
+        }
+        killed = true;
+    }
+#endif // _WIN32
+
+    for (size_t i = 0; i < jobs->running.count; ++i) {
+        BCC_Job *job = &jobs->running.items[i];
+#ifdef _WIN32
+        WaitForSingleObject(job->proc, INFINITE);
+        bcc_proc_usage(job->proc, &job->usage);
+        bcc_trace_proc_end(job->proc, 1, &job->usage);
+        CloseHandle(job->proc);
+#endif // _WIN32
+        // NOTE: the output of the cancelled jobs is not going to tell anything about the failure
+        bcc_job_output_discard(job);
+        bcc_cmd_free(job->cmd);
+        bcc_jobs_track(-1);
+    }
+
+    jobs->running.count = 0;
+    jobs->queued_next = jobs->queued.count;
+    jobs->mem_used_kb = 0;
+    jobs->wants_token = false;
+    bcc_jobs_release_tokens(jobs);
+}
+
+bool bcc_jobs_wait(BCC_Jobs *jobs)
+{
+    bool result = true;
+    while (jobs->queued_next < jobs->queued.count || jobs->running.count > 0) {
+        while (jobs->queued_next < jobs->queued.count && bcc_jobs_has_free_slot(jobs)) {
+            BCC_Job *next = &jobs->queued.items[jobs->queued_next++];
+            if (!bcc_jobs_start(jobs, next->cmd, next->tag)) result = false;
+        }
+        if (!result && !bcc_options.keep_going) {
+            bcc_jobs_cancel(jobs);
+            break;
+        }
+
+        BCC_Job job;
+        bool ok = false;
+        if (!bcc_jobs_reap(jobs, &job, &ok)) {
+            if (jobs->interrupted || jobs->running.count > 0) return false;
+            continue;
+        }
+        if (job.proc == BCC_INVALID_PROC) continue;
+        bcc_cmd_free(job.cmd);
+        if (!ok) {
+            result = false;
+            if (!bcc_options.keep_going) bcc_jobs_cancel(jobs);
+        }
+    }
+    return result;
+}
+
+void bcc_jobs_free(BCC_Jobs *jobs)
+{
+    for (size_t i = 0; i < jobs->queued.count; ++i) {
+        bcc_cmd_free(jobs->queued.items[i].cmd);
+    }
+    for (size_t i = 0; i < jobs->running.count; ++i) {
+        bcc_job_output_discard(&jobs->running.items[i]);
+        bcc_cmd_free(jobs->running.items[i].cmd);
+    }
+    bcc_da_free(jobs->queued);
+    bcc_da_free(jobs->running);
+    for (; jobs->tokens > 0; --jobs->tokens) bcc_jobserver_release();
+    memset(jobs, 0, sizeof(*jobs));
+}
+
+typedef struct {
+    size_t *items;
+    size_t count;
+    size_t capacity;
+} BCC_Indices;
+
+BCC_Rule *bcc_graph_rule(BCC_Graph *graph)
+{
+    BCC_Rule rule = {0};
+    bcc_da_append(graph, rule);
+    return &graph->items[graph->count - 1];
+}
+
+static bool bcc_deps_log_load_depfile(BCC_Deps_Log *log, const char *output_path, uint64_t output_mtime, const char *depfile_path)
+{
+    int depfile_exists = bcc_file_exists(depfile_path);
+    if (depfile_exists <= 0) return false;
+
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_File_Paths deps = {0};
+    bool result = bcc_parse_depfile(depfile_path, &deps) &&
+                  bcc_deps_log_record(log, output_path, output_mtime, deps.items, deps.count);
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+static bool bcc_mtime_is_fresher(uint64_t input_mtime, uint64_t output_mtime);
+
+// Same as bcc_needs_rebuild_depfile, but the dependencies come from the deps log. The
+// depfile is only parsed when the log does not know about the current output yet.
+static int bcc_needs_rebuild_deps_log(BCC_Deps_Log *log, const char *output_path, const char *depfile_path, const char **input_paths, size_t input_paths_count)
+{
+    int rebuild_is_needed = bcc_needs_rebuild(output_path, input_paths, input_paths_count);
+    if (rebuild_is_needed != 0) return rebuild_is_needed;
+
+    uint64_t output_mtime = 0;
+    int output_exists = bcc_file_mtime(output_path, &output_mtime);
+    if (output_exists <= 0) return output_exists < 0 ? -1 : 1;
+
+    const BCC_Deps_Record *record = bcc_deps_log_lookup(log, output_path);
+    if (record == NULL || record->mtime != output_mtime) {
+        if (!bcc_deps_log_load_depfile(log, output_path, output_mtime, depfile_path)) return 1;
+        record = bcc_deps_log_lookup(log, output_path);
+        BCC_ASSERT(record != NULL);
+    }
+
+    for (uint32_t i = 0; i < record->count; ++i) {
+        uint64_t dep_mtime = 0;
+        // NOTE: a header that disappeared since the last build is not an error. It just
+        // means the output has to be rebuilt to find out the new set of headers.
+        int dep_exists = bcc_file_mtime(log->paths.paths.items[record->ids[i]], &dep_mtime);
+        if (dep_exists <= 0) return dep_exists < 0 ? -1 : 1;
+        if (bcc_mtime_is_fresher(dep_mtime, output_mtime)) return 1;
+    }
+
+    return 0;
+}
+
+// Path of source from a file in dir: how a generated file #includes it, or how a thin archive
+// refers to its member
+static const char *bcc_path_from_dir(const char *dir, const char *source)
+{
+    while (strncmp(source, "./", 2) == 0) source += 2;
+    if (source[0] == '/' || (source[0] != '\0' && source[1] == ':')) return source;
+
+    BCC_String_Builder path = {0};
+    BCC_String_View sv = bcc_sv_from_cstr(dir);
+    BCC_String_View rest = bcc_sv_from_cstr(source);
+    bool common = true;
+    while (sv.count > 0) {
+        BCC_String_View component = bcc_sv_chop_by_delim(&sv, '/');
+        if (component.count == 0 || bcc_sv_eq(component, bcc_sv_from_cstr("."))) continue;
+        // The directories both of them start with are left out
+        if (common) {
+            BCC_String_View next = rest;
+            BCC_String_View source_component = bcc_sv_chop_by_delim(&next, '/');
+            common = next.count > 0 && bcc_sv_eq(component, source_component);
+            if (common) {
+                rest = next;
+                continue;
+            }
+        }
+        bcc_sb_append_cstr(&path, "../");
+    }
+    bcc_sb_append_buf(&path, rest.data, rest.count);
+    bcc_sb_append_null(&path);
+    const char *result = bcc_temp_strdup(path.items);
+    bcc_sb_free(path);
+    return result;
+}
+
+void bcc_rule_depfile(BCC_Rule *rule, const char *depfile_path)
+{
+    rule->depfile = depfile_path;
+    bcc_cmd_append(&rule->cmd, "-MMD", "-MF", depfile_path);
+}
+
+const char *bcc_graph_pch(BCC_Graph *graph, const char *dir, const char **headers, size_t headers_count, BCC_Cmd flags)
+{
+    BCC_Cmd fingerprint = {0};
+    bcc_da_append_many(&fingerprint, flags.items, flags.count);
+    bcc_da_append_many(&fingerprint, headers, headers_count);
+    uint64_t hash = bcc_cmd_hash(fingerprint);
+    bcc_cmd_free(fingerprint);
+
+    const char *header_path = bcc_temp_sprintf("%s/pch_%016llx.h", dir, (unsigned long long) hash);
+    BCC_String_Builder content = {0};
+    bcc_sb_append_cstr(&content, "// Generated by bcc, see bcc_graph_pch\n");
+    for (size_t i = 0; i < headers_count; ++i) {
+        bcc_sb_append_cstr(&content, bcc_temp_sprintf("#include \"%s\"\n", bcc_path_from_dir(dir, headers[i])));
+    }
+    bool written = bcc_write_entire_file_if_changed(header_path, content.items, content.count);
+    bcc_sb_free(content);
+    if (!written) return NULL;
+
+    const char *output_path = bcc_temp_sprintf("%s.gch", header_path);
+    BCC_Rule *rule = bcc_graph_rule(graph);
+    bcc_rule_outputs(rule, output_path);
+    bcc_rule_inputs(rule, header_path);
+    bcc_da_append_many(&rule->inputs, headers, headers_count);
+    bcc_da_append_many(&rule->cmd, flags.items, flags.count);
+    bcc_cmd_append(&rule->cmd, "-x", "c-header", header_path);
+    bcc_cmd_append(&rule->cmd, "-o", output_path);
+    bcc_rule_depfile(rule, bcc_temp_sprintf("%s.d", header_path));
+    return header_path;
+}
+
+void bcc_rule_pch(BCC_Rule *rule, const char *pch)
+{
+    bcc_rule_inputs(rule, bcc_temp_sprintf("%s.gch", pch));
+    bcc_cmd_append(&rule->cmd, "-include", pch, "-Winvalid-pch");
+}
+
+// Whether the argument at index is the -include of bcc_rule_pch
+static bool bcc_rule_is_pch_include(const BCC_Rule *rule, size_t index)
+{
+    if (strcmp(rule->cmd.items[index], "-include") != 0 || index + 1 >= rule->cmd.count) return false;
+    const char *header = rule->cmd.items[index + 1];
+    size_t header_len = strlen(header);
+    for (size_t i = 0; i < rule->inputs.count; ++i) {
+        const char *input = rule->inputs.items[i];
+        if (strncmp(input, header, header_len) == 0 && strcmp(input + header_len, ".gch") == 0) return true;
+    }
+    return false;
+}
+
+bool bcc_compile_commands_write(const BCC_Graph *graph, const char *file_path)
+{
+    char cwd[4096];
+#ifdef _WIN32
+    bool has_cwd = _getcwd(cwd, sizeof(cwd)) != NULL;
+#else
+    bool has_cwd = getcwd(cwd, sizeof(cwd)) != NULL;
+#endif // _WIN32
+    if (!has_cwd) {
+        bcc_log(BCC_ERROR, "could not get the current directory: %s", strerror(errno));
+        return false;
+    }
+
+    BCC_String_Builder content = {0};
+    bcc_sb_append_cstr(&content, "[");
+    size_t entries = 0;
+    for (size_t i = 0; i < graph->count; ++i) {
+        const BCC_Rule *rule = &graph->items[i];
+        bool compiles = false;
+        for (size_t j = 0; j < rule->cmd.count && !compiles; ++j) compiles = strcmp(rule->cmd.items[j], "-c") == 0;
+        if (!compiles) continue;
+
+        // The source is the first input that is on the command line, the rest are headers and such
+        const char *source = NULL;
+        for (size_t j = 0; j < rule->inputs.count && source == NULL; ++j) {
+            for (size_t k = 0; k < rule->cmd.count; ++k) {
+                if (strcmp(rule->inputs.items[j], rule->cmd.items[k]) == 0) {
+                    source = rule->inputs.items[j];
+                    break;
+                }
+            }
+        }
+        if (source == NULL) continue;
+
+        bcc_sb_append_cstr(&content, entries++ > 0 ? ",\n" : "\n");
+        bcc_sb_append_cstr(&content, "  {\"directory\": ");
+        bcc_sb_append_json_string(&content, cwd);
+        bcc_sb_append_cstr(&content, ", \"file\": ");
+        bcc_sb_append_json_string(&content, source);
+        if (rule->outputs.count > 0) {
+            bcc_sb_append_cstr(&content, ", \"output\": ");
+            bcc_sb_append_json_string(&content, rule->outputs.items[0]);
+        }
+        bcc_sb_append_cstr(&content, ", \"arguments\": [");
+        for (size_t j = 0; j < rule->cmd.count; ++j) {
+            // NOTE: the sources include the headers of the precompiled one themselves anyway
+            if (bcc_rule_is_pch_include(rule, j)) {
+                j += 1;
+                if (j + 1 < rule->cmd.count && strcmp(rule->cmd.items[j + 1], "-Winvalid-pch") == 0) j += 1;
+                continue;
+            }
+            if (j > 0) bcc_sb_append_cstr(&content, ", ");
+            bcc_sb_append_json_string(&content, rule->cmd.items[j]);
+        }
+        bcc_sb_append_cstr(&content, "]}");
+    }
+    bcc_sb_append_cstr(&content, "\n]\n");
+
+    bool result = bcc_write_entire_file_if_changed(file_path, content.items, content.count);
+    bcc_sb_free(content);
+    return result;
+}
+
+// State of a single bcc_graph_build
+typedef struct {
+    BCC_Graph *graph;
+    BCC_Jobs *jobs;
+    size_t *pending;          // rule -> amount of unfinished rules it depends on
+    BCC_Indices *dependents;  // rule -> rules that depend on it
+    BCC_Indices ready;
+    size_t ready_next;
+    size_t finished;
+    BCC_Deps_Log deps_log;
+    bool has_deps_log;
+    BCC_Build_Log build_log;
+    bool has_build_log;
+    BCC_Cache cache;
+    bool has_cache;
+    const char *remote_cache; // URL of the remote cache. NULL if there is none
+    bool *pulled;             // rule -> the remote cache has already been asked for it
+    bool *stale;              // rule -> checked already, it is ready but waits for a job slot
+    BCC_Indices pull_batch;   // Cacheable rules that have missed locally and wait for a pull
+    struct {
+        BCC_Indices *items;   // Rules of the pulls that have been started, see BCC_GRAPH_PULL_TAG
+        size_t count;
+        size_t capacity;
+    } pulls;
+    BCC_Cmd pushes;           // Manifest keys of the fresh objects to upload
+    size_t pushes_next;
+    bool pushing;             // A push is running, the keys that come in meanwhile wait for the next one
+    uint64_t *priority;       // rule -> longest path from it to the end of the build, see bcc_graph_compute_priorities
+    uint64_t *memory;         // rule -> peak memory its command has taken last time, from the build log
+    BCC_Proc_Usage *usage;    // rule -> what its command has used in this build
+    BCC_Indices ran;          // Rules whose commands have run in this build
+} BCC_Graph_Build;
+
+// Tags of the jobs of bcc_graph_build that do not run a rule. Pulls are tagged with
+// BCC_GRAPH_PULL_TAG + their index in BCC_Graph_Build.pulls.
+#define BCC_GRAPH_PUSH_TAG ((size_t) -1)
+#define BCC_GRAPH_PULL_TAG (((size_t) -1)/2)
+
+// Start a child process of the program to transfer entries between the local and remote caches
+static bool bcc_graph_start_transfer(BCC_Graph_Build *build, const char *subcommand, const char **manifest_keys, size_t count, size_t tag)
+{
+    BCC_Cmd cmd = {0};
+    bcc_cmd_append(&cmd, bcc_options.args.items[0], subcommand);
+    bcc_cmd_append(&cmd, bcc_temp_sprintf("--cache-dir=%s", build->cache.dir));
+    bcc_cmd_append(&cmd, bcc_temp_sprintf("--remote-cache=%s", build->remote_cache));
+    bcc_da_append_many(&cmd, manifest_keys, count);
+    bool result = bcc_jobs_start(build->jobs, cmd, tag);
+    bcc_cmd_free(cmd);
+    return result;
+}
+
+// Give up on the remote cache for the rest of the build
+static void bcc_graph_disable_remote_cache(BCC_Graph_Build *build)
+{
+    if (build->remote_cache == NULL) return;
+    bcc_log(BCC_WARNING, "remote cache %s is not available, building locally", build->remote_cache);
+    build->remote_cache = NULL;
+}
+
+// Pull everything that has missed locally so far in a single transfer
+static void bcc_graph_start_pull(BCC_Graph_Build *build)
+{
+    BCC_Indices batch = build->pull_batch;
+    memset(&build->pull_batch, 0, sizeof(build->pull_batch));
+
+    BCC_Cmd manifest_keys = {0};
+    for (size_t i = 0; i < batch.count; ++i) {
+        uint64_t key = 0;
+        if (!bcc_cache_manifest_key(&build->graph->items[batch.items[i]], &key)) continue;
+        bcc_da_append(&manifest_keys, bcc_temp_sprintf("%016llx", (unsigned long long) key));
+    }
+
+    if (bcc_graph_start_transfer(build, "cache-pull", manifest_keys.items, manifest_keys.count, BCC_GRAPH_PULL_TAG + build->pulls.count)) {
+        bcc_da_append(&build->pulls, batch);
+    } else {
+        bcc_graph_disable_remote_cache(build);
+        for (size_t i = 0; i < batch.count; ++i) bcc_da_append(&build->ready, batch.items[i]);
+        bcc_da_free(batch);
+    }
+    bcc_cmd_free(manifest_keys);
+}
+
+// Upload every fresh object so far in a single transfer, once the previous one is done
+static void bcc_graph_start_pushes(BCC_Graph_Build *build)
+{
+    if (build->pushing || build->remote_cache == NULL || build->pushes_next == build->pushes.count) return;
+    if (!bcc_jobs_has_free_slot(build->jobs)) return;
+    size_t count = build->pushes.count - build->pushes_next;
+    if (bcc_graph_start_transfer(build, "cache-push", build->pushes.items + build->pushes_next, count, BCC_GRAPH_PUSH_TAG)) {
+        build->cache.uploads += count;
+        build->pushing = true;
+    } else {
+        bcc_graph_disable_remote_cache(build);
+    }
+    build->pushes_next = build->pushes.count;
+}
+
+// Hash of the content of the inputs of the rule and of the dependencies in its depfile
+static bool bcc_graph_inputs_hash(const BCC_Rule *rule, uint64_t *hash)
+{
+    bool result = true;
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_File_Paths deps = {0};
+    bcc_da_append_many(&deps, rule->inputs.items, rule->inputs.count);
+    if (rule->depfile && !bcc_parse_depfile(rule->depfile, &deps)) bcc_return_defer(false);
+
+    *hash = bcc_hash_cstr(BCC_HASH_INIT, "bcc inputs v1");
+    for (size_t i = 0; i < deps.count; ++i) {
+        uint64_t content = 0;
+        if (!bcc_file_hash(deps.items[i], &content)) bcc_return_defer(false);
+        *hash = bcc_hash_cstr(*hash, deps.items[i]);
+        *hash = bcc_hash_update(*hash, &content, sizeof(content));
+    }
+    // NOTE: 0 means unknown in the build log
+    if (*hash == 0) *hash = 1;
+
+defer:
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+// With BCC_CHANGES_HASH an output that looks out of date may still have been built from the
+// very same content. Then it is touched, so the mtimes agree again for the next build.
+static bool bcc_graph_rule_is_unchanged(BCC_Graph_Build *build, const BCC_Rule *rule)
+{
+    if (!build->has_build_log || rule->outputs.count == 0) return false;
+    const BCC_Build_Log_Entry *entry = bcc_build_log_lookup(&build->build_log, rule->outputs.items[0]);
+    if (entry == NULL || entry->inputs_hash == 0) return false;
+    for (size_t i = 0; i < rule->outputs.count; ++i) {
+        if (bcc_file_exists(rule->outputs.items[i]) <= 0) return false;
+    }
+    if (rule->depfile && bcc_file_exists(rule->depfile) <= 0) return false;
+
+    uint64_t inputs_hash = 0;
+    if (!bcc_graph_inputs_hash(rule, &inputs_hash) || inputs_hash != entry->inputs_hash) return false;
+    for (size_t i = 0; i < rule->outputs.count; ++i) {
+        if (!bcc_touch(rule->outputs.items[i])) return false;
+    }
+    return true;
+}
+
+static void bcc_graph_record_rule(BCC_Graph_Build *build, const BCC_Rule *rule, const BCC_Proc_Usage *usage);
+
+// RETURNS:
+//  0 - all of the outputs are up to date
+//  1 - the rule must be run
+// -1 - error while checking the outputs. The error is logged
+static int bcc_graph_rule_needs_rebuild(BCC_Graph_Build *build, const BCC_Rule *rule)
+{
+    if (rule->outputs.count == 0) return 1;
+    int stale = 0;
+    for (size_t i = 0; i < rule->outputs.count && stale == 0; ++i) {
+        const char *output_path = rule->outputs.items[i];
+        int rebuild_is_needed = 0;
+        if (rule->depfile && build->has_deps_log) {
+            rebuild_is_needed = bcc_needs_rebuild_deps_log(&build->deps_log, output_path, rule->depfile, rule->inputs.items, rule->inputs.count);
+        } else if (rule->depfile) {
+            rebuild_is_needed = bcc_needs_rebuild_depfile(output_path, rule->depfile, rule->inputs.items, rule->inputs.count);
+        } else {
+            rebuild_is_needed = bcc_needs_rebuild(output_path, rule->inputs.items, rule->inputs.count);
+        }
+        stale = rebuild_is_needed;
+    }
+    if (stale < 0) return -1;
+
+    if (build->has_build_log) {
+        uint64_t cmd_hash = bcc_cmd_hash(rule->cmd);
+        for (size_t i = 0; i < rule->outputs.count; ++i) {
+            const BCC_Build_Log_Entry *entry = bcc_build_log_lookup(&build->build_log, rule->outputs.items[i]);
+            if (entry == NULL || entry->cmd_hash != cmd_hash) {
+                if (stale == 0) bcc_log(BCC_INFO, "command line of %s has changed", rule->outputs.items[i]);
+                return 1;
+            }
+        }
+    }
+
+    if (stale && bcc_options.changes == BCC_CHANGES_HASH && bcc_graph_rule_is_unchanged(build, rule)) {
+        // The touched outputs have new mtimes, the deps log has to know about them
+        bcc_graph_record_rule(build, rule, NULL);
+        return 0;
+    }
+    return stale;
+}
+
+// Remember everything about the rule that has just been brought up to date. The usage is NULL
+// if its command did not have to run, then the previous measurements are kept.
+static void bcc_graph_record_rule(BCC_Graph_Build *build, const BCC_Rule *rule, const BCC_Proc_Usage *usage)
+{
+    if (rule->depfile && build->has_deps_log && rule->outputs.count > 0) {
+        const char *output_path = rule->outputs.items[0];
+        uint64_t output_mtime = 0;
+        if (bcc_file_mtime(output_path, &output_mtime) <= 0 ||
+            !bcc_deps_log_load_depfile(&build->deps_log, output_path, output_mtime, rule->depfile)) {
+            bcc_log(BCC_WARNING, "could not record the dependencies of %s", output_path);
+        }
+    }
+
+    if (build->has_build_log) {
+        uint64_t cmd_hash = bcc_cmd_hash(rule->cmd);
+        uint64_t inputs_hash = 0;
+        if (bcc_options.changes == BCC_CHANGES_HASH && !bcc_graph_inputs_hash(rule, &inputs_hash)) inputs_hash = 0;
+        for (size_t i = 0; i < rule->outputs.count; ++i) {
+            BCC_Build_Log_Entry entry = {0};
+            const BCC_Build_Log_Entry *previous = bcc_build_log_lookup(&build->build_log, rule->outputs.items[i]);
+            if (usage != NULL) {
+                entry.cpu_us = usage->user_us + usage->sys_us;
+                entry.max_rss_kb = usage->max_rss_kb;
+                entry.wall_us = usage->wall_us;
+            } else if (previous != NULL) {
+                entry = *previous;
+            }
+            entry.cmd_hash = cmd_hash;
+            entry.inputs_hash = inputs_hash;
+            bcc_build_log_record(&build->build_log, rule->outputs.items[i], entry);
+        }
+    }
+}
+
+// Weigh every rule by the wall time its command has taken last time and compute the longest
+// path from it to the end of the build. Commands without a history count as an average one.
+// Also looks up the peak memory of every command.
+static void bcc_graph_compute_priorities(BCC_Graph_Build *build)
+{
+    const BCC_Graph *graph = build->graph;
+    uint64_t known_total = 0;
+    size_t known_count = 0;
+    for (size_t i = 0; i < graph->count && build->has_build_log; ++i) {
+        const BCC_Rule *rule = &graph->items[i];
+        for (size_t j = 0; j < rule->outputs.count; ++j) {
+            const BCC_Build_Log_Entry *entry = bcc_build_log_lookup(&build->build_log, rule->outputs.items[j]);
+            if (entry != NULL && entry->wall_us > build->priority[i]) build->priority[i] = entry->wall_us;
+        }
+        if (build->priority[i] > 0) {
+            known_total += build->priority[i];
+            known_count += 1;
+        }
+    }
+    uint64_t average = known_count > 0 ? known_total/known_count : 1;
+    for (size_t i = 0; i < graph->count; ++i) {
+        if (build->priority[i] == 0 && graph->items[i].cmd.count > 0) build->priority[i] = average;
+    }
+
+    // Same for the memory, which decides when the job pool admits the command
+    known_total = 0;
+    known_count = 0;
+    for (size_t i = 0; i < graph->count && build->has_build_log; ++i) {
+        const BCC_Rule *rule = &graph->items[i];
+        for (size_t j = 0; j < rule->outputs.count; ++j) {
+            const BCC_Build_Log_Entry *entry = bcc_build_log_lookup(&build->build_log, rule->outputs.items[j]);
+            if (entry != NULL && entry->max_rss_kb > build->memory[i]) build->memory[i] = entry->max_rss_kb;
+        }
+        if (build->memory[i] > 0) {
+            known_total += build->memory[i];
+            known_count += 1;
+        }
+    }
+    average = known_count > 0 ? known_total/known_count : 0;
+    for (size_t i = 0; i < graph->count; ++i) {
+        if (build->memory[i] == 0 && graph->items[i].cmd.count > 0) build->memory[i] = average;
+    }
+
+    // Topological order, so every rule comes after all of the rules it depends on
+    size_t *pending = malloc(graph->count*sizeof(*pending));
+    BCC_ASSERT(pending != NULL && "Buy more RAM lol");
+    memcpy(pending, build->pending, graph->count*sizeof(*pending));
+    BCC_Indices order = {0};
+    for (size_t i = 0; i < graph->count; ++i) {
+        if (pending[i] == 0) bcc_da_append(&order, i);
+    }
+    for (size_t i = 0; i < order.count; ++i) {
+        const BCC_Indices *dependents = &build->dependents[order.items[i]];
+        for (size_t j = 0; j < dependents->count; ++j) {
+            if (--pending[dependents->items[j]] == 0) bcc_da_append(&order, dependents->items[j]);
+        }
+    }
+
+    // NOTE: the rules of a dependency cycle are not in the order and keep their own weight.
+    // The build reports the cycle anyway.
+    for (size_t i = order.count; i > 0; --i) {
+        size_t index = order.items[i - 1];
+        const BCC_Indices *dependents = &build->dependents[index];
+        uint64_t longest = 0;
+        for (size_t j = 0; j < dependents->count; ++j) {
+            if (build->priority[dependents->items[j]] > longest) longest = build->priority[dependents->items[j]];
+        }
+        build->priority[index] += longest;
+    }
+
+    bcc_da_free(order);
+    free(pending);
+}
+
+static const BCC_Graph_Build *bcc_graph_report_build = NULL;
+
+static int bcc_graph_report_compare(const void *a, const void *b)
+{
+    const BCC_Proc_Usage *x = &bcc_graph_report_build->usage[*(const size_t*) a];
+    const BCC_Proc_Usage *y = &bcc_graph_report_build->usage[*(const size_t*) b];
+    uint64_t cpu_x = x->user_us + x->sys_us;
+    uint64_t cpu_y = y->user_us + y->sys_us;
+    return (cpu_x < cpu_y) - (cpu_x > cpu_y);
+}
+
+// Table of the resources of every command that has run, the most expensive first
+static void bcc_graph_report(BCC_Graph_Build *build)
+{
+    if (build->ran.count == 0) return;
+
+    bcc_graph_report_build = build;
+    qsort(build->ran.items, build->ran.count, sizeof(*build->ran.items), bcc_graph_report_compare);
+    bcc_graph_report_build = NULL;
+
+    BCC_Proc_Usage total = {0};
+    bcc_log(BCC_INFO, "%10s %10s %10s %10s %9s %9s  %s", "wall", "user", "sys", "max rss", "blk in", "blk out", "output");
+    for (size_t i = 0; i < build->ran.count; ++i) {
+        size_t index = build->ran.items[i];
+        const BCC_Rule *rule = &build->graph->items[index];
+        const BCC_Proc_Usage *usage = &build->usage[index];
+        bcc_log(BCC_INFO, "%9.3fs %9.3fs %9.3fs %8.1fMB %9llu %9llu  %s",
+                usage->wall_us/1e6, usage->user_us/1e6, usage->sys_us/1e6, usage->max_rss_kb/1024.0,
+                (unsigned long long) usage->read_ops, (unsigned long long) usage->write_ops,
+                rule->outputs.count > 0 ? rule->outputs.items[0] : rule->cmd.items[0]);
+        total.user_us += usage->user_us;
+        total.sys_us += usage->sys_us;
+        if (usage->max_rss_kb > total.max_rss_kb) total.max_rss_kb = usage->max_rss_kb;
+    }
+    bcc_log(BCC_INFO, "%zu commands took %.3fs of CPU, %.1fMB at most",
+            build->ran.count, (total.user_us + total.sys_us)/1e6, total.max_rss_kb/1024.0);
+}
+
+static void bcc_graph_finish_rule(BCC_Graph_Build *build, size_t index)
+{
+    build->finished += 1;
+    for (size_t i = 0; i < build->dependents[index].count; ++i) {
+        size_t dependent = build->dependents[index].items[i];
+        if (--build->pending[dependent] == 0) bcc_da_append(&build->ready, dependent);
+    }
+}
+
+bool bcc_graph_build(BCC_Graph *graph, BCC_Jobs *jobs)
+{
+    bool result = true;
+    BCC_Graph_Build build = {0};
+    build.graph = graph;
+    build.jobs = jobs;
+    build.pending = calloc(graph->count, sizeof(*build.pending));
+    build.dependents = calloc(graph->count, sizeof(*build.dependents));
+    BCC_ASSERT(build.pending != NULL && build.dependents != NULL && "Buy more RAM lol");
+    for (size_t i = 0; i < graph->count; ++i) graph->items[i].failed = false;
+    if (jobs->mem_budget_kb == 0 && jobs->running.count == 0) jobs->mem_budget_kb = bcc_mem_budget_kb();
+
+    bcc_trace_begin("load logs");
+    for (size_t i = 0; i < graph->count; ++i) {
+        if (graph->items[i].depfile == NULL) continue;
+        build.has_deps_log = bcc_deps_log_open(&build.deps_log, BCC_DEPS_LOG_PATH);
+        if (!build.has_deps_log) {
+            bcc_log(BCC_WARNING, "could not open the deps log, falling back to parsing depfiles");
+            bcc_deps_log_close(&build.deps_log);
+        }
+        break;
+    }
+
+    build.has_build_log = bcc_build_log_open(&build.build_log, BCC_BUILD_LOG_PATH);
+    if (!build.has_build_log) {
+        bcc_log(BCC_WARNING, "could not open the build log, changes of command lines are not tracked");
+        bcc_build_log_close(&build.build_log);
+    }
+
+    if (!bcc_compile_commands_write(graph, BCC_COMPILE_COMMANDS_PATH)) {
+        bcc_log(BCC_WARNING, "could not write %s", BCC_COMPILE_COMMANDS_PATH);
+    }
+
+    const char *cache_dir = bcc_cache_dir();
+    for (size_t i = 0; i < graph->count && cache_dir != NULL; ++i) {
+        if (!graph->items[i].cacheable) continue;
+        build.has_cache = bcc_cache_init(&build.cache, cache_dir);
+        if (!build.has_cache) bcc_log(BCC_WARNING, "could not initialize the cache in %s, caching is disabled", cache_dir);
+        break;
+    }
+    bcc_trace_end();
+
+    if (build.has_cache && bcc_options.args.count > 0) build.remote_cache = bcc_remote_cache_url();
+    build.pulled = calloc(graph->count, sizeof(*build.pulled));
+    build.stale = calloc(graph->count, sizeof(*build.stale));
+    build.priority = calloc(graph->count, sizeof(*build.priority));
+    build.memory = calloc(graph->count, sizeof(*build.memory));
+    build.usage = calloc(graph->count, sizeof(*build.usage));
+    BCC_ASSERT(build.pulled != NULL && build.stale != NULL && build.priority != NULL && build.memory != NULL && build.usage != NULL && "Buy more RAM lol");
+
+    for (size_t i = 0; i < graph->count; ++i) {
+        const BCC_Rule *rule = &graph->items[i];
+        for (size_t j = 0; j < rule->inputs.count; ++j) {
+            for (size_t k = 0; k < graph->count; ++k) {
+                if (k == i) continue;
+                const BCC_Rule *producer = &graph->items[k];
+                for (size_t l = 0; l < producer->outputs.count; ++l) {
+                    if (strcmp(rule->inputs.items[j], producer->outputs.items[l]) == 0) {
+                        bcc_da_append(&build.dependents[k], i);
+                        build.pending[i] += 1;
+                    }
+                }
+            }
+        }
+    }
+
+    bcc_graph_compute_priorities(&build);
+
+    for (size_t i = 0; i < graph->count; ++i) {
+        if (build.pending[i] == 0) bcc_da_append(&build.ready, i);
+    }
+
+    while (build.finished < graph->count) {
+        // Fail fast: whatever is still running is not going to make the build succeed anymore
+        if (!result && !bcc_options.keep_going) {
+            bcc_jobs_cancel(jobs);
+            break;
+        }
+
+        // NOTE: with --keep-going the rules that depend on a failed one just never get ready
+        while ((result || bcc_options.keep_going) && build.ready_next < build.ready.count) {
+            // NOTE: the rules that have not been checked yet go first. An up to date rule, a cache
+            // hit or a builtin does not need a job, so it does not wait for a slot or for memory.
+            size_t best = SIZE_MAX;
+            for (size_t i = build.ready_next; i < build.ready.count && best == SIZE_MAX; ++i) {
+                if (!build.stale[build.ready.items[i]]) best = i;
+            }
+            if (best == SIZE_MAX) {
+                // The rule on the critical path goes first, so the long chains do not end up at the
+                // tail of the build with all the other cores idle
+                // NOTE: a rule that does not fit into the memory that is left waits for the running
+                // jobs, the smaller ones behind it may still go
+                for (size_t i = build.ready_next; i < build.ready.count; ++i) {
+                    size_t candidate = build.ready.items[i];
+                    if (!bcc_jobs_has_room(jobs, build.memory[candidate])) continue;
+                    if (best == SIZE_MAX || build.priority[candidate] > build.priority[build.ready.items[best]]) best = i;
+                }
+                if (best == SIZE_MAX) break;
+                // NOTE: the jobserver token is only taken once the job is sure to start
+                if (!bcc_jobs_has_free_slot(jobs)) break;
+            }
+            size_t index = build.ready.items[best];
+            build.ready.items[best] = build.ready.items[build.ready_next];
+            build.ready.items[build.ready_next++] = index;
+            const BCC_Rule *rule = &graph->items[index];
+
+            if (build.stale[index]) {
+                build.stale[index] = false;
+                if (!bcc_jobs_start_mem(jobs, rule->cmd, index, build.memory[index])) result = false;
+                continue;
+            }
+
+            const char *rule_name = rule->outputs.count > 0 ? rule->outputs.items[0] : "phony";
+            bcc_trace_begin(bcc_temp_sprintf("check %s", rule_name));
+            int rebuild_is_needed = rule->cmd.count > 0 ? bcc_graph_rule_needs_rebuild(&build, rule) : 0;
+            bcc_trace_end();
+            if (rebuild_is_needed < 0) {
+                result = false;
+                break;
+            }
+
+            if (rebuild_is_needed && rule->cacheable && build.has_cache) {
+                // NOTE: the lookup before the pull has already been counted as a miss
+                if (build.pulled[index]) build.cache.misses -= 1;
+                bcc_trace_begin(bcc_temp_sprintf("cache fetch %s", rule_name));
+                bool hit = bcc_cache_fetch(&build.cache, rule);
+                bcc_trace_end();
+                if (hit) {
+                    if (build.pulled[index]) build.cache.remote_hits += 1;
+                    bcc_graph_record_rule(&build, rule, NULL);
+                    bcc_graph_finish_rule(&build, index);
+                    continue;
+                }
+                if (build.remote_cache && !build.pulled[index]) {
+                    build.pulled[index] = true;
+                    bcc_da_append(&build.pull_batch, index);
+                    continue;
+                }
+                // NOTE: the output may be a hard link into the cache. The compiler would
+                // overwrite the cached object in place if it was not unlinked first.
+                for (size_t i = 0; i < rule->outputs.count; ++i) remove(rule->outputs.items[i]);
+            }
+
+            if (rebuild_is_needed && rule->builtin != NULL) {
+                // NOTE: built right here in between the jobs, so builtins have to be quick
+                bcc_trace_begin(rule_name);
+                uint64_t start = bcc_trace_now();
+                int built = rule->builtin(rule);
+                BCC_Proc_Usage usage = {0};
+                usage.wall_us = bcc_trace_now() - start;
+                bcc_trace_end();
+                if (built > 0) {
+                    bcc_graph_record_rule(&build, rule, &usage);
+                    bcc_graph_finish_rule(&build, index);
+                    continue;
+                }
+                if (built == 0) {
+                    graph->items[index].failed = true;
+                    result = false;
+                    continue;
+                }
+            }
+
+            if (rebuild_is_needed) {
+                // Back among the ready ones to wait for a slot
+                build.stale[index] = true;
+                build.ready_next -= 1;
+                continue;
+            }
+
+            bcc_graph_finish_rule(&build, index);
+        }
+
+        if (build.pull_batch.count > 0) {
+            if (!build.remote_cache) {
+                // NOTE: the remote has gone away in the meantime, straight to the compiler with them
+                for (size_t i = 0; i < build.pull_batch.count; ++i) bcc_da_append(&build.ready, build.pull_batch.items[i]);
+                build.pull_batch.count = 0;
+                continue;
+            }
+            if (bcc_jobs_has_free_slot(jobs)) bcc_graph_start_pull(&build);
+        }
+        if (result || bcc_options.keep_going) bcc_graph_start_pushes(&build);
+
+        if (build.finished == graph->count) break;
+        if (jobs->running.count == 0) {
+            if (build.ready_next < build.ready.count && (result || bcc_options.keep_going)) continue;
+            if (!result) break;
+            bcc_log(BCC_ERROR, "dependency cycle detected in the build graph");
+            bcc_return_defer(false);
+        }
+
+        BCC_Job job;
+        bool ok = false;
+        if (!bcc_jobs_reap(jobs, &job, &ok)) bcc_return_defer(false);
+        if (job.proc == BCC_INVALID_PROC) continue;
+        bcc_cmd_free(job.cmd);
+        if (job.tag == BCC_GRAPH_PUSH_TAG) {
+            build.pushing = false;
+            if (!ok) bcc_graph_disable_remote_cache(&build);
+            continue;
+        }
+        if (job.tag >= BCC_GRAPH_PULL_TAG) {
+            // Whatever has been pulled is in the local cache now, look the rules up once more
+            if (!ok) bcc_graph_disable_remote_cache(&build);
+            BCC_Indices *batch = &build.pulls.items[job.tag - BCC_GRAPH_PULL_TAG];
+            bcc_da_append_many(&build.ready, batch->items, batch->count);
+            bcc_da_free(*batch);
+            memset(batch, 0, sizeof(*batch));
+            continue;
+        }
+        if (!ok) {
+            graph->items[job.tag].failed = true;
+            result = false;
+            continue;
+        }
+
+        const BCC_Rule *rule = &graph->items[job.tag];
+        if (rule->cacheable && build.has_cache) {
+            bcc_trace_begin(bcc_temp_sprintf("cache store %s", rule->outputs.items[0]));
+            bool stored = bcc_cache_store(&build.cache, rule);
+            bcc_trace_end();
+            uint64_t key = 0;
+            if (stored && build.remote_cache && bcc_cache_manifest_key(rule, &key)) {
+                bcc_da_append(&build.pushes, bcc_temp_sprintf("%016llx", (unsigned long long) key));
+            }
+        }
+        build.usage[job.tag] = job.usage;
+        bcc_da_append(&build.ran, job.tag);
+        bcc_graph_record_rule(&build, rule, &job.usage);
+        bcc_graph_finish_rule(&build, job.tag);
+    }
+
+    if (!result && bcc_options.keep_going && build.finished < graph->count) {
+        bcc_log(BCC_ERROR, "%zu of %zu rules could not be built", graph->count - build.finished, graph->count);
+    }
+
+    // Let the uploads to the remote cache finish before the build is over
+    while ((result || bcc_options.keep_going) && ((build.remote_cache && build.pushes_next < build.pushes.count) || jobs->running.count > 0)) {
+        bcc_graph_start_pushes(&build);
+        BCC_Job job;
+        bool ok = false;
+        if (!bcc_jobs_reap(jobs, &job, &ok)) break;
+        if (job.proc == BCC_INVALID_PROC) continue;
+        bcc_cmd_free(job.cmd);
+        if (job.tag == BCC_GRAPH_PUSH_TAG) build.pushing = false;
+        if (!ok) bcc_graph_disable_remote_cache(&build);
+    }
+
+defer:
+    bcc_trace_begin("save logs");
+    bcc_graph_report(&build);
+    if (build.has_cache) bcc_cache_report(&build.cache);
+    if (build.has_deps_log && !bcc_deps_log_close(&build.deps_log)) result = false;
+    if (build.has_build_log && !bcc_build_log_close(&build.build_log)) result = false;
+    bcc_file_hashes_save();
+    bcc_trace_end();
+    for (size_t i = 0; i < graph->count; ++i) bcc_da_free(build.dependents[i]);
+    free(build.dependents);
+    free(build.pending);
+    free(build.pulled);
+    free(build.stale);
+    free(build.priority);
+    free(build.memory);
+    free(build.usage);
+    bcc_da_free(build.ran);
+    bcc_da_free(build.ready);
+    bcc_da_free(build.pull_batch);
+    for (size_t i = 0; i < build.pulls.count; ++i) bcc_da_free(build.pulls.items[i]);
+    bcc_da_free(build.pulls);
+    bcc_da_free(build.pushes);
+    return result;
+}
+
+void bcc_graph_free(BCC_Graph *graph)
+{
+    for (size_t i = 0; i < graph->count; ++i) {
+        bcc_da_free(graph->items[i].outputs);
+        bcc_da_free(graph->items[i].inputs);
+        bcc_cmd_free(graph->items[i].cmd);
+    }
+    bcc_da_free(*graph);
+    memset(graph, 0, sizeof(*graph));
+}
+
+// Read the sources back out of a unity translation unit generated by bcc_unity_plan
+static bool bcc_unity_read(const char *path, const char *dir, const char **sources, size_t count, BCC_Indices *group)
+{
+    BCC_String_Builder content = {0};
+    if (bcc_file_exists(path) <= 0 || !bcc_read_entire_file(path, &content)) return false;
+
+    BCC_String_View sv = bcc_sv_from_parts(content.items, content.count);
+    BCC_String_View include = bcc_sv_from_cstr("#include \"");
+    while (sv.count > 0) {
+        BCC_String_View line = bcc_sv_trim(bcc_sv_chop_by_delim(&sv, '\n'));
+        if (line.count <= include.count || !bcc_sv_eq(bcc_sv_from_parts(line.data, include.count), include)) continue;
+        line = bcc_sv_from_parts(line.data + include.count, line.count - include.count - 1);
+        size_t i = 0;
+        while (i < count && !bcc_sv_eq(line, bcc_sv_from_cstr(bcc_path_from_dir(dir, sources[i])))) i += 1;
+        if (i == count) {
+            group->count = 0;
+            break;
+        }
+        bcc_da_append(group, i);
+    }
+    bcc_sb_free(content);
+    return group->count > 0;
+}
+
+// Sources of the unity groups that have failed, compiled on their own until bcc_unity_fallback
+// knows whether they compile like that at all
+static BCC_File_Paths bcc_unity_pending = {0};
+static BCC_Indices bcc_unity_pending_groups = {0}; // pending source -> the group it has failed in
+
+// Indices of the sources that bcc_unity_fallback has taken out of the unity groups and that have not changed since
+static void bcc_unity_load_excluded(const char **sources, size_t count, bool *excluded)
+{
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < bcc_unity_pending.count && !excluded[i]; ++j) {
+            excluded[i] = strcmp(sources[i], bcc_unity_pending.items[j]) == 0;
+        }
+    }
+
+    BCC_String_Builder content = {0};
+    if (bcc_file_exists(BCC_UNITY_EXCLUDE_PATH) <= 0 || !bcc_read_entire_file(BCC_UNITY_EXCLUDE_PATH, &content)) return;
+
+    BCC_String_View sv = bcc_sv_from_parts(content.items, content.count);
+    while (sv.count > 0) {
+        BCC_String_View line = bcc_sv_chop_by_delim(&sv, '\n');
+        BCC_String_View hash_sv = bcc_sv_chop_by_delim(&line, '\t');
+        if (line.count == 0) continue;
+        uint64_t hash = strtoull(bcc_temp_sv_to_cstr(hash_sv), NULL, 16);
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t source_hash = 0;
+            if (excluded[i] || !bcc_sv_eq(line, bcc_sv_from_cstr(sources[i]))) continue;
+            excluded[i] = bcc_file_hash(sources[i], &source_hash) && source_hash == hash;
+        }
+    }
+    bcc_sb_free(content);
+}
+
+// Longest processing time first: the heaviest source goes into the lightest group
+static void bcc_unity_balance(const char **sources, const char **objects, const size_t *candidates, size_t candidates_count, size_t groups_count, BCC_Indices *groups)
+{
+    uint64_t *weights = calloc(candidates_count, sizeof(*weights));
+    uint64_t *sizes = calloc(candidates_count, sizeof(*sizes));
+    uint64_t *loads = calloc(groups_count, sizeof(*loads));
+    size_t *order = calloc(candidates_count, sizeof(*order));
+    BCC_ASSERT(weights != NULL && sizes != NULL && loads != NULL && order != NULL && "Buy more RAM lol");
+
+    // NOTE: the sources that have never been compiled on their own are weighed by their size,
+    // at the speed of the ones that have
+    uint64_t known_us = 0, known_size = 0;
+    BCC_Build_Log log = {0};
+    bool has_log = bcc_build_log_open(&log, BCC_BUILD_LOG_PATH);
+    for (size_t i = 0; i < candidates_count; ++i) {
+        BCC_File_Stat file_stat = {0};
+        if (bcc_file_stat(sources[candidates[i]], &file_stat) > 0) sizes[i] = file_stat.size;
+        const BCC_Build_Log_Entry *entry = has_log ? bcc_build_log_lookup(&log, objects[candidates[i]]) : NULL;
+        if (entry != NULL && entry->wall_us > 0) {
+            weights[i] = entry->wall_us;
+            known_us += entry->wall_us;
+            known_size += sizes[i];
+        }
+    }
+    bcc_build_log_close(&log);
+    for (size_t i = 0; i < candidates_count; ++i) {
+        if (weights[i] > 0) continue;
+        weights[i] = known_size > 0 ? (uint64_t) ((double) sizes[i]*known_us/known_size) : sizes[i];
+    }
+
+    for (size_t i = 0; i < candidates_count; ++i) {
+        size_t j = i;
+        for (; j > 0 && weights[order[j - 1]] < weights[i]; --j) order[j] = order[j - 1];
+        order[j] = i;
+    }
+    for (size_t i = 0; i < candidates_count; ++i) {
+        size_t lightest = 0;
+        for (size_t g = 1; g < groups_count; ++g) {
+            if (loads[g] < loads[lightest]) lightest = g;
+        }
+        loads[lightest] += weights[order[i]];
+        bcc_da_append(&groups[lightest], candidates[order[i]]);
+    }
+
+    // Same order as the sources were given in, so the translation units come out the same
+    // for the same split
+    for (size_t g = 0; g < groups_count; ++g) {
+        for (size_t i = 1; i < groups[g].count; ++i) {
+            size_t index = groups[g].items[i];
+            size_t j = i;
+            for (; j > 0 && groups[g].items[j - 1] > index; --j) groups[g].items[j] = groups[g].items[j - 1];
+            groups[g].items[j] = index;
+        }
+    }
+
+    free(weights);
+    free(sizes);
+    free(loads);
+    free(order);
+}
+
+bool bcc_unity_plan(BCC_Unity *unity, const char *dir, const char **sources, const char **objects, size_t count, size_t max_groups)
+{
+    bool result = true;
+    bool *excluded = calloc(count, sizeof(*excluded));
+    size_t *candidates = calloc(count, sizeof(*candidates));
+    BCC_Indices *groups = calloc(count, sizeof(*groups));
+    BCC_ASSERT(excluded != NULL && candidates != NULL && groups != NULL && "Buy more RAM lol");
+    BCC_String_Builder content = {0};
+
+    if (max_groups == 0) max_groups = bcc_max_jobs();
+    if (max_groups > count) max_groups = count;
+
+    bcc_unity_load_excluded(sources, count, excluded);
+    size_t candidates_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (excluded[i]) {
+            BCC_Unity_Group group = {0};
+            bcc_da_append(&group.sources, sources[i]);
+            group.object = objects[i];
+            bcc_da_append(unity, group);
+        } else {
+            candidates[candidates_count++] = i;
+        }
+    }
+    size_t groups_count = max_groups > count - candidates_count ? max_groups - (count - candidates_count) : 1;
+    if (groups_count > candidates_count) groups_count = candidates_count;
+
+    // Keep the split of the previous run as long as it covers the same sources with the same
+    // amount of groups
+    size_t unity_count = 0;
+    size_t covered = 0;
+    bool *seen = calloc(count, sizeof(*seen));
+    BCC_ASSERT(seen != NULL && "Buy more RAM lol");
+    bool reuse = true;
+    while (reuse && unity_count < groups_count) {
+        BCC_Indices *group = &groups[unity_count];
+        if (!bcc_unity_read(bcc_temp_sprintf("%s/unity_%zu.c", dir, unity_count), dir, sources, count, group)) break;
+        for (size_t i = 0; i < group->count && reuse; ++i) {
+            reuse = !excluded[group->items[i]] && !seen[group->items[i]];
+            seen[group->items[i]] = true;
+        }
+        if (group->count < 2) reuse = false;
+        covered += group->count;
+        unity_count += 1;
+    }
+    free(seen);
+    if (reuse && unity_count + (candidates_count - covered) == groups_count) {
+        for (size_t i = 0; i < candidates_count; ++i) {
+            bool grouped = false;
+            for (size_t g = 0; g < unity_count && !grouped; ++g) {
+                for (size_t j = 0; j < groups[g].count && !grouped; ++j) grouped = groups[g].items[j] == candidates[i];
+            }
+            if (grouped) continue;
+            bcc_da_append(&groups[unity_count], candidates[i]);
+            unity_count += 1;
+        }
+    } else {
+        for (size_t g = 0; g < count; ++g) groups[g].count = 0;
+        bcc_unity_balance(sources, objects, candidates, candidates_count, groups_count, groups);
+    }
+
+    size_t k = 0;
+    for (size_t g = 0; g < groups_count; ++g) {
+        BCC_Unity_Group group = {0};
+        for (size_t i = 0; i < groups[g].count; ++i) bcc_da_append(&group.sources, sources[groups[g].items[i]]);
+        if (groups[g].count == 1) {
+            group.object = objects[groups[g].items[0]];
+            bcc_da_append(unity, group);
+            continue;
+        }
+
+        group.path = bcc_temp_sprintf("%s/unity_%zu.c", dir, k);
+        group.object = bcc_temp_sprintf("%s/unity_%zu.o", dir, k);
+        k += 1;
+        content.count = 0;
+        bcc_sb_append_cstr(&content, "// Generated by bcc, see bcc_unity_plan\n");
+        for (size_t i = 0; i < group.sources.count; ++i) {
+            bcc_sb_append_cstr(&content, bcc_temp_sprintf("#include \"%s\"\n", bcc_path_from_dir(dir, group.sources.items[i])));
+        }
+        bcc_da_append(unity, group);
+        if (!bcc_write_entire_file_if_changed(group.path, content.items, content.count)) bcc_return_defer(false);
+    }
+
+    // NOTE: leftovers of a split into more groups would be taken for the previous split next time
+    for (;; ++k) {
+        const char *path = bcc_temp_sprintf("%s/unity_%zu.c", dir, k);
+        if (bcc_file_exists(path) <= 0) break;
+        if (remove(path) < 0) {
+            bcc_log(BCC_ERROR, "could not remove %s: %s", path, strerror(errno));
+            bcc_return_defer(false);
+        }
+    }
+
+defer:
+    for (size_t g = 0; g < count; ++g) bcc_da_free(groups[g]);
+    free(groups);
+    free(candidates);
+    free(excluded);
+    bcc_sb_free(content);
+    return result;
+}
+
+// The rule of the graph that compiles the group
+static const BCC_Rule *bcc_unity_group_rule(const BCC_Unity_Group *group, const BCC_Graph *graph)
+{
+    for (size_t i = 0; i < graph->count; ++i) {
+        const BCC_Rule *rule = &graph->items[i];
+        if (rule->outputs.count > 0 && strcmp(rule->outputs.items[0], group->object) == 0) return rule;
+    }
+    return NULL;
+}
+
+bool bcc_unity_fallback(const BCC_Unity *unity, const BCC_Graph *graph)
+{
+    bool result = false;
+    FILE *file = NULL;
+
+    // Whether the pending sources have compiled on their own
+    bool *compiled = calloc(bcc_unity_pending.count + 1, sizeof(*compiled));
+    BCC_ASSERT(compiled != NULL && "Buy more RAM lol");
+    for (size_t j = 0; j < bcc_unity_pending.count; ++j) {
+        for (size_t g = 0; g < unity->count; ++g) {
+            const BCC_Unity_Group *group = &unity->items[g];
+            if (group->path != NULL || strcmp(group->sources.items[0], bcc_unity_pending.items[j]) != 0) continue;
+            const BCC_Rule *rule = bcc_unity_group_rule(group, graph);
+            compiled[j] = rule != NULL && !rule->failed && bcc_needs_rebuild(group->object, rule->inputs.items, rule->inputs.count) == 0;
+        }
+    }
+
+    // NOTE: a group with a source that does not compile on its own either has failed because
+    // of that one, whether the others combine or not is still unknown
+    for (size_t j = 0; j < bcc_unity_pending.count; ++j) {
+        size_t failed_group = bcc_unity_pending_groups.items[j];
+        bool all_compiled = true;
+        for (size_t k = 0; k < bcc_unity_pending.count; ++k) {
+            if (bcc_unity_pending_groups.items[k] == failed_group && !compiled[k]) all_compiled = false;
+        }
+        uint64_t hash = 0;
+        if (!all_compiled || !bcc_file_hash(bcc_unity_pending.items[j], &hash)) continue;
+        if (file == NULL) file = fopen(BCC_UNITY_EXCLUDE_PATH, "ab");
+        if (file == NULL) {
+            bcc_log(BCC_ERROR, "could not open %s: %s", BCC_UNITY_EXCLUDE_PATH, strerror(errno));
+            bcc_return_defer(false);
+        }
+        bcc_log(BCC_INFO, "%s only compiles on its own, it is kept out of the unity groups from now on", bcc_unity_pending.items[j]);
+        fprintf(file, "%016llx\t%s\n", (unsigned long long) hash, bcc_unity_pending.items[j]);
+    }
+    for (size_t j = 0; j < bcc_unity_pending.count; ++j) free((char *) bcc_unity_pending.items[j]);
+    bcc_unity_pending.count = 0;
+    bcc_unity_pending_groups.count = 0;
+
+    for (size_t g = 0; g < unity->count; ++g) {
+        const BCC_Unity_Group *group = &unity->items[g];
+        if (group->path == NULL) continue;
+        const BCC_Rule *rule = bcc_unity_group_rule(group, graph);
+        if (rule == NULL || !rule->failed) continue;
+        bcc_log(BCC_WARNING, "%s did not compile, trying its %zu sources on their own", group->path, group->sources.count);
+        for (size_t j = 0; j < group->sources.count; ++j) {
+            char *source = strdup(group->sources.items[j]);
+            BCC_ASSERT(source != NULL && "Buy more RAM lol");
+            bcc_da_append(&bcc_unity_pending, source);
+            bcc_da_append(&bcc_unity_pending_groups, g);
+        }
+        result = true;
+    }
+
+defer:
+    free(compiled);
+    if (file) fclose(file);
+    return result;
+}
+
+void bcc_unity_free(BCC_Unity *unity)
+{
+    for (size_t i = 0; i < unity->count; ++i) bcc_da_free(unity->items[i].sources);
+    bcc_da_free(*unity);
+    memset(unity, 0, sizeof(*unity));
+}
+
+static bool bcc_rename_quiet(const char *old_path, const char *new_path);
+
+// The archive members as bcc_ar_write sees them
+typedef struct {
+    const char *name;          // Name in the archive, the path relative to it in thin archives
+    const unsigned char *data; // Content of the member, NULL in thin archives
+    size_t size;
+    size_t header_offset;      // Where the header of the member is in the archive
+    BCC_File_Paths symbols;    // Defined global symbols of the member
+} BCC_Ar_Member;
+
+typedef struct {
+    BCC_Ar_Member *items;
+    size_t count;
+    size_t capacity;
+} BCC_Ar_Members;
+
+#define BCC_AR_MAGIC "!<arch>\n"
+#define BCC_AR_THIN_MAGIC "!<thin>\n"
+#define BCC_AR_HEADER_SIZE 60
+
+// Little endian field of an object file, 0 if it is out of bounds
+static uint64_t bcc_obj_field(const unsigned char *data, size_t size, uint64_t offset, size_t width)
+{
+    if (offset > size || width > size - offset) return 0;
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; ++i) value |= (uint64_t) data[offset + i] << (8*i);
+    return value;
+}
+
+// NULL-terminated string of an object file, NULL if it runs out of bounds
+static const char *bcc_obj_cstr(const unsigned char *data, size_t size, uint64_t offset)
+{
+    if (offset >= size || memchr(data + offset, '\0', size - offset) == NULL) return NULL;
+    return (const char *) data + offset;
+}
+
+typedef struct {
+    uint64_t name;
+    uint64_t type;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t link;
+    uint64_t entsize;
+} BCC_Elf_Section;
+
+static BCC_Elf_Section bcc_elf_section(const unsigned char *data, size_t size, bool is64, uint64_t header)
+{
+    BCC_Elf_Section section = {0};
+    section.name = bcc_obj_field(data, size, header, 4);
+    section.type = bcc_obj_field(data, size, header + 4, 4);
+    section.offset = bcc_obj_field(data, size, header + (is64 ? 0x18 : 0x10), is64 ? 8 : 4);
+    section.size = bcc_obj_field(data, size, header + (is64 ? 0x20 : 0x14), is64 ? 8 : 4);
+    section.link = bcc_obj_field(data, size, header + (is64 ? 0x28 : 0x18), 4);
+    section.entsize = bcc_obj_field(data, size, header + (is64 ? 0x38 : 0x24), is64 ? 8 : 4);
+    return section;
+}
+
+// Defined global symbols of a little endian ELF object
+static bool bcc_elf_symbols(const unsigned char *data, size_t size, BCC_File_Paths *symbols)
+{
+    if (size < 0x40 || (data[4] != 1 && data[4] != 2) || data[5] != 1) return false;
+    bool is64 = data[4] == 2;
+    uint64_t shoff = bcc_obj_field(data, size, is64 ? 0x28 : 0x20, is64 ? 8 : 4);
+    uint64_t shentsize = bcc_obj_field(data, size, is64 ? 0x3A : 0x2E, 2);
+    uint64_t shnum = bcc_obj_field(data, size, is64 ? 0x3C : 0x30, 2);
+    uint64_t shstrndx = bcc_obj_field(data, size, is64 ? 0x3E : 0x32, 2);
+    if (shoff == 0) return true;
+    if (shentsize < (is64 ? 0x40u : 0x28u) || shoff > size) return false;
+    // NOTE: objects with a lot of sections keep the real numbers in the first section header
+    BCC_Elf_Section first = bcc_elf_section(data, size, is64, shoff);
+    if (shnum == 0) shnum = first.size;
+    if (shstrndx == 0xffff) shstrndx = first.link;
+    if (shnum > (size - shoff)/shentsize || shstrndx >= shnum) return false;
+
+    BCC_Elf_Section names = bcc_elf_section(data, size, is64, shoff + shstrndx*shentsize);
+    for (uint64_t i = 0; i < shnum; ++i) {
+        BCC_Elf_Section section = bcc_elf_section(data, size, is64, shoff + i*shentsize);
+        // NOTE: the symbols of LTO objects are only known to the linker plugin
+        const char *name = bcc_obj_cstr(data, size, names.offset + section.name);
+        if (name != NULL && strncmp(name, ".gnu.lto_", 9) == 0) return false;
+    }
+
+    for (uint64_t i = 0; i < shnum; ++i) {
+        BCC_Elf_Section section = bcc_elf_section(data, size, is64, shoff + i*shentsize);
+        if (section.type != 2) continue; // SHT_SYMTAB
+        if (section.entsize == 0 || section.offset > size || section.size > size - section.offset || section.link >= shnum) return false;
+        BCC_Elf_Section strings = bcc_elf_section(data, size, is64, shoff + section.link*shentsize);
+        for (uint64_t j = 1; j < section.size/section.entsize; ++j) {
+            uint64_t symbol = section.offset + j*section.entsize;
+            uint64_t name = bcc_obj_field(data, size, symbol, 4);
+            uint8_t bind = bcc_obj_field(data, size, symbol + (is64 ? 4 : 12), 1) >> 4;
+            uint64_t shndx = bcc_obj_field(data, size, symbol + (is64 ? 6 : 14), 2);
+            // STB_GLOBAL, STB_WEAK and STB_GNU_UNIQUE that are not SHN_UNDEF
+            if ((bind != 1 && bind != 2 && bind != 10) || shndx == 0) continue;
+            const char *cstr = bcc_obj_cstr(data, size, strings.offset + name);
+            if (cstr == NULL) return false;
+            bcc_da_append(symbols, cstr);
+        }
+    }
+    return true;
+}
+
+// Defined external symbols of a COFF object, what mingw and MSVC produce
+static bool bcc_coff_symbols(const unsigned char *data, size_t size, BCC_File_Paths *symbols)
+{
+    uint64_t machine = bcc_obj_field(data, size, 0, 2);
+    // i386, amd64, armnt and arm64. Big objects (-mbig-obj) have a different header.
+    if (machine != 0x14c && machine != 0x8664 && machine != 0x1c4 && machine != 0xaa64) return false;
+    if (size < 20 || bcc_obj_field(data, size, 16, 2) != 0) return false;
+    uint64_t sections = bcc_obj_field(data, size, 2, 2);
+    uint64_t symtab = bcc_obj_field(data, size, 8, 4);
+    uint64_t symbols_count = bcc_obj_field(data, size, 12, 4);
+    if (symtab > size || symbols_count > (size - symtab)/18 || sections > (size - 20)/40) return false;
+    uint64_t strings = symtab + symbols_count*18;
+
+    for (uint64_t i = 0; i < sections; ++i) {
+        const char *name = (const char *) data + 20 + i*40;
+        if (name[0] != '/') continue;
+        const char *cstr = bcc_obj_cstr(data, size, strings + strtoull(bcc_temp_sprintf("%.*s", 7, name + 1), NULL, 10));
+        if (cstr != NULL && strncmp(cstr, ".gnu.lto_", 9) == 0) return false;
+    }
+
+    for (uint64_t i = 0; i < symbols_count; ++i) {
+        uint64_t symbol = symtab + i*18;
+        uint64_t value = bcc_obj_field(data, size, symbol + 8, 4);
+        int16_t section = (int16_t) bcc_obj_field(data, size, symbol + 12, 2);
+        uint8_t storage_class = data[symbol + 16];
+        uint8_t aux = data[symbol + 17];
+        // IMAGE_SYM_CLASS_EXTERNAL in a section, absolute or common
+        bool external = storage_class == 2 && (section > 0 || section == -1 || (section == 0 && value != 0));
+        // NOTE: IMAGE_SYM_CLASS_WEAK_EXTERNAL that falls back to another symbol, what
+        // __attribute__((weak)) produces. GNU ar leaves them out of the index, but then the
+        // linker never pulls the member in for them, so they are indexed the same as llvm-ar does.
+        bool weak_external = storage_class == 105 && aux > 0 && bcc_obj_field(data, size, symbol + 18 + 4, 4) == 3;
+        if (external || weak_external) {
+            const char *name = NULL;
+            if (bcc_obj_field(data, size, symbol, 4) == 0) {
+                name = bcc_obj_cstr(data, size, strings + bcc_obj_field(data, size, symbol + 4, 4));
+            } else {
+                const char *short_name = (const char *) data + symbol;
+                name = bcc_temp_sprintf("%.*s", (int) strnlen(short_name, 8), short_name);
+            }
+            if (name == NULL) return false;
+            bcc_da_append(symbols, name);
+        }
+        i += aux;
+    }
+    return true;
+}
+
+// Defined global symbols of an object, false if it is not an object they can be found in
+static bool bcc_ar_object_symbols(const unsigned char *data, size_t size, BCC_File_Paths *symbols)
+{
+    if (size >= 4 && memcmp(data, "\x7f" "ELF", 4) == 0) return bcc_elf_symbols(data, size, symbols);
+    return bcc_coff_symbols(data, size, symbols);
+}
+
+static uint32_t bcc_ar_be32(const unsigned char *data)
+{
+    return (uint32_t) data[0] << 24 | (uint32_t) data[1] << 16 | (uint32_t) data[2] << 8 | (uint32_t) data[3];
+}
+
+// Members of a GNU archive together with their symbols from the index
+static bool bcc_ar_parse(const unsigned char *data, size_t size, BCC_Ar_Members *members)
+{
+    if (size < 8 || memcmp(data, BCC_AR_MAGIC, 8) != 0) return false;
+
+    const unsigned char *index = NULL;
+    size_t index_size = 0;
+    const char *names = NULL;
+    size_t names_size = 0;
+    size_t offset = 8;
+    while (offset + BCC_AR_HEADER_SIZE <= size) {
+        const char *header = (const char *) data + offset;
+        if (memcmp(header + 58, "`\n", 2) != 0) return false;
+        size_t member_size = strtoull(bcc_temp_sprintf("%.*s", 10, header + 48), NULL, 10);
+        if (member_size > size - offset - BCC_AR_HEADER_SIZE) return false;
+        const unsigned char *member = data + offset + BCC_AR_HEADER_SIZE;
+
+        if (memcmp(header, "/ ", 2) == 0) {
+            index = member;
+            index_size = member_size;
+        } else if (memcmp(header, "// ", 3) == 0) {
+            names = (const char *) member;
+            names_size = member_size;
+        } else if (memcmp(header, "/SYM64/", 7) != 0) {
+            BCC_Ar_Member m = {0};
+            if (header[0] == '/') {
+                size_t at = strtoull(bcc_temp_sprintf("%.*s", 15, header + 1), NULL, 10);
+                if (names == NULL || at >= names_size) return false;
+                const char *end = memchr(names + at, '\n', names_size - at);
+                if (end == NULL || end == names + at) return false;
+                m.name = bcc_temp_sprintf("%.*s", (int) (end - 1 - (names + at)), names + at);
+            } else {
+                const char *end = memchr(header, '/', 16);
+                if (end == NULL) return false;
+                m.name = bcc_temp_sprintf("%.*s", (int) (end - header), header);
+            }
+            m.data = member;
+            m.size = member_size;
+            m.header_offset = offset;
+            bcc_da_append(members, m);
+        }
+        offset += BCC_AR_HEADER_SIZE + member_size + (member_size & 1);
+    }
+
+    if (index == NULL) return true;
+    if (index_size < 4) return false;
+    uint32_t count = bcc_ar_be32(index);
+    if (count > (index_size - 4)/4) return false;
+    const char *name = (const char *) index + 4 + 4*count;
+    const char *end = (const char *) index + index_size;
+    for (uint32_t i = 0; i < count; ++i) {
+        size_t length = strnlen(name, end - name);
+        if (length == (size_t) (end - name)) return false;
+        uint32_t header_offset = bcc_ar_be32(index + 4 + 4*i);
+        for (size_t j = 0; j < members->count; ++j) {
+            if (members->items[j].header_offset != header_offset) continue;
+            bcc_da_append(&members->items[j].symbols, name);
+            break;
+        }
+        name += length + 1;
+    }
+    return true;
+}
+
+static void bcc_ar_append_header(BCC_String_Builder *sb, const char *name, int mode, size_t size)
+{
+    char header[BCC_AR_HEADER_SIZE + 1];
+    // NOTE: no timestamps nor owners, the same members always make the same archive (`ar D`)
+    if (strcmp(name, "//") == 0) {
+        // The long names have nothing but a size, like GNU ar writes them
+        snprintf(header, sizeof(header), "%-48s%-10zu`\n", name, size);
+    } else {
+        snprintf(header, sizeof(header), "%-16s%-12d%-6d%-6d%-8o%-10zu`\n", name, 0, 0, 0, mode, size);
+    }
+    bcc_sb_append_buf(sb, header, BCC_AR_HEADER_SIZE);
+}
+
+static void bcc_ar_append_be32(BCC_String_Builder *sb, uint32_t value)
+{
+    char bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+    bcc_sb_append_buf(sb, bytes, 4);
+}
+
+int bcc_ar_write(const char *archive_path, const char **member_paths, size_t count, bool thin)
+{
+    int result = 1;
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_String_Builder old_content = {0};
+    BCC_String_Builder content = {0};
+    BCC_String_Builder names = {0};
+    BCC_Ar_Members old_members = {0};
+    BCC_Ar_Members members = {0};
+    const char **header_names = NULL;
+    BCC_String_Builder *member_contents = calloc(count, sizeof(*member_contents));
+    BCC_ASSERT(member_contents != NULL && "Buy more RAM lol");
+
+    const char *slash = strrchr(archive_path, '/');
+    const char *dir = slash ? bcc_temp_sprintf("%.*s", (int) (slash - archive_path), archive_path) : ".";
+
+    if (bcc_file_exists(archive_path) > 0 && bcc_read_entire_file(archive_path, &old_content) && !thin) {
+        // NOTE: anything that is not a GNU archive is just written over
+        if (!bcc_ar_parse((const unsigned char *) old_content.items, old_content.count, &old_members)) old_members.count = 0;
+    }
+
+    size_t changed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!bcc_read_entire_file(member_paths[i], &member_contents[i])) bcc_return_defer(0);
+        BCC_Ar_Member member = {0};
+        member.data = (const unsigned char *) member_contents[i].items;
+        member.size = member_contents[i].count;
+        if (thin) {
+            member.name = bcc_path_from_dir(dir, member_paths[i]);
+        } else {
+            const char *basename = strrchr(member_paths[i], '/');
+            member.name = basename ? basename + 1 : member_paths[i];
+        }
+
+        bool reused = false;
+        for (size_t j = 0; j < old_members.count && !reused; ++j) {
+            BCC_Ar_Member *old = &old_members.items[j];
+            if (old->data == NULL || old->size != member.size || strcmp(old->name, member.name) != 0) continue;
+            if (member.size > 0 && memcmp(old->data, member.data, member.size) != 0) continue;
+            bcc_da_append_many(&member.symbols, old->symbols.items, old->symbols.count);
+            old->data = NULL;
+            reused = true;
+        }
+        if (!reused) {
+            changed += 1;
+            if (!bcc_ar_object_symbols(member.data, member.size, &member.symbols)) {
+                bcc_log(BCC_INFO, "%s cannot be indexed in process", member_paths[i]);
+                bcc_da_free(member.symbols);
+                bcc_return_defer(-1);
+            }
+        }
+        bcc_da_append(&members, member);
+    }
+
+    // Lay the archive out: the symbol index, the long names, then the members
+    size_t symbols_count = 0;
+    size_t index_size = 4;
+    for (size_t i = 0; i < members.count; ++i) {
+        for (size_t j = 0; j < members.items[i].symbols.count; ++j) index_size += 4 + strlen(members.items[i].symbols.items[j]) + 1;
+        symbols_count += members.items[i].symbols.count;
+    }
+    index_size += index_size & 1;
+
+    header_names = calloc(members.count, sizeof(*header_names));
+    BCC_ASSERT((header_names != NULL || members.count == 0) && "Buy more RAM lol");
+    for (size_t i = 0; i < members.count; ++i) {
+        const char *name = members.items[i].name;
+        if (!thin && strlen(name) < 16 && strchr(name, ' ') == NULL) {
+            header_names[i] = bcc_temp_sprintf("%s/", name);
+        } else {
+            header_names[i] = bcc_temp_sprintf("/%zu", names.count);
+            bcc_sb_append_cstr(&names, name);
+            bcc_sb_append_cstr(&names, "/\n");
+        }
+    }
+    if (names.count & 1) bcc_sb_append_cstr(&names, "\n");
+
+    size_t offset = 8;
+    if (symbols_count > 0) offset += BCC_AR_HEADER_SIZE + index_size;
+    if (names.count > 0) offset += BCC_AR_HEADER_SIZE + names.count;
+    for (size_t i = 0; i < members.count; ++i) {
+        members.items[i].header_offset = offset;
+        offset += BCC_AR_HEADER_SIZE;
+        if (!thin) offset += members.items[i].size + (members.items[i].size & 1);
+    }
+    if (offset > UINT32_MAX) {
+        bcc_log(BCC_INFO, "%s is too big for a 32 bit symbol index", archive_path);
+        bcc_return_defer(-1);
+    }
+
+    bcc_sb_append_cstr(&content, thin ? BCC_AR_THIN_MAGIC : BCC_AR_MAGIC);
+    if (symbols_count > 0) {
+        bcc_ar_append_header(&content, "/", 0, index_size);
+        size_t index_start = content.count;
+        bcc_ar_append_be32(&content, symbols_count);
+        for (size_t i = 0; i < members.count; ++i) {
+            for (size_t j = 0; j < members.items[i].symbols.count; ++j) bcc_ar_append_be32(&content, members.items[i].header_offset);
+        }
+        for (size_t i = 0; i < members.count; ++i) {
+            for (size_t j = 0; j < members.items[i].symbols.count; ++j) {
+                const char *symbol = members.items[i].symbols.items[j];
+                bcc_sb_append_buf(&content, symbol, strlen(symbol) + 1);
+            }
+        }
+        if (content.count - index_start < index_size) bcc_sb_append_buf(&content, "", 1);
+    }
+    if (names.count > 0) {
+        bcc_ar_append_header(&content, "//", 0, names.count);
+        bcc_sb_append_buf(&content, names.items, names.count);
+    }
+    for (size_t i = 0; i < members.count; ++i) {
+        bcc_ar_append_header(&content, header_names[i], 0644, members.items[i].size);
+        if (thin) continue;
+        bcc_sb_append_buf(&content, members.items[i].data, members.items[i].size);
+        if (members.items[i].size & 1) bcc_sb_append_cstr(&content, "\n");
+    }
+
+    bcc_log(BCC_INFO, "AR: %s (%zu of %zu members changed)", archive_path, changed, count);
+    if (content.count == old_content.count && memcmp(content.items, old_content.items, content.count) == 0) {
+        // NOTE: still has to be newer than its members, or it would be out of date forever
+        if (!bcc_touch(archive_path)) bcc_return_defer(0);
+    } else {
+        const char *temp_path = bcc_temp_sprintf("%s.tmp", archive_path);
+        if (!bcc_write_entire_file(temp_path, content.items, content.count)) bcc_return_defer(0);
+        if (!bcc_rename_quiet(temp_path, archive_path)) bcc_return_defer(0);
+    }
+
+defer:
+    for (size_t i = 0; i < count; ++i) bcc_sb_free(member_contents[i]);
+    free(member_contents);
+    free(header_names);
+    for (size_t i = 0; i < old_members.count; ++i) bcc_da_free(old_members.items[i].symbols);
+    bcc_da_free(old_members);
+    for (size_t i = 0; i < members.count; ++i) bcc_da_free(members.items[i].symbols);
+    bcc_da_free(members);
+    bcc_sb_free(names);
+    bcc_sb_free(content);
+    bcc_sb_free(old_content);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+static int bcc_rule_ar_build_impl(const BCC_Rule *rule, bool thin)
+{
+    const char *archive_path = rule->outputs.items[0];
+    int built = bcc_ar_write(archive_path, rule->inputs.items, rule->inputs.count, thin);
+    // NOTE: `ar -crs` adds to the archive that is already there, so the members that are not
+    // inputs anymore would stay in it. The command starts from scratch instead.
+    if (built < 0 && remove(archive_path) != 0 && errno != ENOENT) {
+        bcc_log(BCC_ERROR, "Could not remove %s: %s", archive_path, strerror(errno));
+        return 0;
+    }
+    return built;
+}
+
+static int bcc_rule_ar_build(const BCC_Rule *rule)
+{
+    return bcc_rule_ar_build_impl(rule, false);
+}
+
+static int bcc_rule_ar_build_thin(const BCC_Rule *rule)
+{
+    return bcc_rule_ar_build_impl(rule, true);
+}
+
+void bcc_rule_ar(BCC_Rule *rule, bool thin)
+{
+    BCC_ASSERT(rule->outputs.count > 0 && "the rule needs the archive as its output");
+    rule->cmd.count = 0;
+    bcc_cmd_append(&rule->cmd, "ar", thin ? "-crsT" : "-crs", rule->outputs.items[0]);
+    bcc_da_append_many(&rule->cmd, rule->inputs.items, rule->inputs.count);
+    rule->builtin = thin ? bcc_rule_ar_build_thin : bcc_rule_ar_build;
+}
+
+// Run the command with its output thrown away, only whether it succeeds matters
+static bool bcc_cmd_run_sync_quiet(BCC_Cmd cmd)
+{
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES attributes = { sizeof(attributes), NULL, TRUE };
+    BCC_Fd null_fd = CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &attributes, OPEN_EXISTING, 0, NULL);
+#else
+    BCC_Fd null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+#endif // _WIN32
+    if (null_fd == BCC_INVALID_FD) return bcc_cmd_run_sync(cmd);
+
+    BCC_Proc proc = bcc_cmd_spawn(cmd, false, null_fd);
+#ifdef _WIN32
+    CloseHandle(null_fd);
+#else
+    close(null_fd);
+#endif // _WIN32
+    if (proc == BCC_INVALID_PROC) return false;
+    return bcc_proc_wait(proc);
+}
+
+bool bcc_linker_available(const char *compiler, const char *linker)
+{
+    uint64_t identity = bcc_compiler_identity(compiler);
+
+    BCC_String_Builder content = {0};
+    if (bcc_file_exists(BCC_LINKERS_PATH) > 0) bcc_read_entire_file(BCC_LINKERS_PATH, &content);
+    BCC_String_View sv = bcc_sv_from_parts(content.items, content.count);
+    while (sv.count > 0) {
+        BCC_String_View line = bcc_sv_chop_by_delim(&sv, '\n');
+        BCC_String_View identity_sv = bcc_sv_chop_by_delim(&line, '\t');
+        BCC_String_View linker_sv = bcc_sv_chop_by_delim(&line, '\t');
+        if (strtoull(bcc_temp_sv_to_cstr(identity_sv), NULL, 16) != identity) continue;
+        if (!bcc_sv_eq(linker_sv, bcc_sv_from_cstr(linker))) continue;
+        bcc_sb_free(content);
+        return bcc_sv_eq(line, bcc_sv_from_cstr("1"));
+    }
+    bcc_sb_free(content);
+
+    // NOTE: only a real link tells. The compiler may find a linker that does not support its
+    // target, like mold for a mingw gcc.
+    const char *source_path = bcc_temp_sprintf("%s.c", BCC_LINKERS_PATH);
+    const char *output_path = bcc_temp_sprintf("%s.out", BCC_LINKERS_PATH);
+    const char *source = "int main(void) { return 0; }\n";
+    if (!bcc_write_entire_file_if_changed(source_path, source, strlen(source))) return false;
+    bcc_log(BCC_INFO, "checking whether `%s` can link with %s", compiler, linker);
+    BCC_Cmd cmd = {0};
+    bcc_cmd_append(&cmd, compiler, bcc_temp_sprintf("-fuse-ld=%s", linker), source_path, "-o", output_path);
+    bool available = bcc_cmd_run_sync_quiet(cmd);
+    bcc_cmd_free(cmd);
+    remove(output_path);
+    bcc_log(BCC_INFO, "%s is %savailable", linker, available ? "" : "not ");
+
+    FILE *file = fopen(BCC_LINKERS_PATH, "ab");
+    if (file == NULL) {
+        bcc_log(BCC_WARNING, "could not open %s: %s", BCC_LINKERS_PATH, strerror(errno));
+        return available;
+    }
+    fprintf(file, "%016llx\t%s\t%d\n", (unsigned long long) identity, linker, available);
+    fclose(file);
+    return available;
+}
+
+bool bcc_rule_linker(BCC_Rule *rule)
+{
+    const char *linker = bcc_options.linker;
+    if (linker == NULL || rule->cmd.count == 0) return true;
+    const char *compiler = rule->cmd.items[0];
+
+    if (strcmp(linker, "auto") == 0) {
+        static const char *linkers[] = { BCC_LINKERS };
+        for (size_t i = 0; i < BCC_ARRAY_LEN(linkers); ++i) {
+            if (!bcc_linker_available(compiler, linkers[i])) continue;
+            bcc_cmd_append(&rule->cmd, bcc_temp_sprintf("-fuse-ld=%s", linkers[i]));
+            return true;
+        }
+        return true;
+    }
+
+    if (!bcc_linker_available(compiler, linker)) {
+        bcc_log(BCC_ERROR, "`%s` cannot link with %s", compiler, linker);
+        return false;
+    }
+    bcc_cmd_append(&rule->cmd, bcc_temp_sprintf("-fuse-ld=%s", linker));
+    return true;
+}
+
+bool bcc_bench_link(const BCC_Graph *graph, const char *output_path, size_t runs)
+{
+    const BCC_Rule *rule = NULL;
+    for (size_t i = 0; i < graph->count && rule == NULL; ++i) {
+        if (graph->items[i].outputs.count > 0 && strcmp(graph->items[i].outputs.items[0], output_path) == 0) rule = &graph->items[i];
+    }
+    if (rule == NULL || rule->cmd.count == 0) {
+        bcc_log(BCC_ERROR, "there is no rule that links %s", output_path);
+        return false;
+    }
+    if (runs == 0) runs = 1;
+
+    bool result = true;
+    const char *bench_path = bcc_temp_sprintf("%s.bench", output_path);
+    const char *linkers[] = { NULL, BCC_LINKERS };
+    uint64_t min_us[BCC_ARRAY_LEN(linkers)] = {0};
+    uint64_t median_us[BCC_ARRAY_LEN(linkers)] = {0};
+    bool measured[BCC_ARRAY_LEN(linkers)] = {0};
+    uint64_t *times = calloc(runs, sizeof(*times));
+    BCC_ASSERT(times != NULL && "Buy more RAM lol");
+    BCC_Cmd cmd = {0};
+
+    for (size_t i = 0; i < BCC_ARRAY_LEN(linkers); ++i) {
+        if (linkers[i] != NULL && !bcc_linker_available(rule->cmd.items[0], linkers[i])) continue;
+
+        // The same link, written elsewhere and with that linker
+        cmd.count = 0;
+        for (size_t j = 0; j < rule->cmd.count; ++j) {
+            const char *arg = rule->cmd.items[j];
+            if (strncmp(arg, "-fuse-ld=", 9) == 0) continue;
+            bcc_cmd_append(&cmd, arg);
+            if (strcmp(arg, "-o") == 0 && j + 1 < rule->cmd.count) {
+                bcc_cmd_append(&cmd, bench_path);
+                j += 1;
+            }
+        }
+        if (linkers[i] != NULL) bcc_cmd_append(&cmd, bcc_temp_sprintf("-fuse-ld=%s", linkers[i]));
+
+        for (size_t run = 0; run < runs; ++run) {
+            uint64_t start = bcc_trace_now();
+            if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
+            uint64_t elapsed = bcc_trace_now() - start;
+            size_t j = run;
+            for (; j > 0 && times[j - 1] > elapsed; --j) times[j] = times[j - 1];
+            times[j] = elapsed;
+        }
+        min_us[i] = times[0];
+        median_us[i] = times[runs/2];
+        measured[i] = true;
+    }
+
+    bcc_log(BCC_INFO, "linking %s, %zu runs each:", output_path, runs);
+    bcc_log(BCC_INFO, "%10s %10s %10s", "linker", "min", "median");
+    for (size_t i = 0; i < BCC_ARRAY_LEN(linkers); ++i) {
+        if (!measured[i]) continue;
+        bcc_log(BCC_INFO, "%10s %9.3fs %9.3fs", linkers[i] ? linkers[i] : "default", min_us[i]/1e6, median_us[i]/1e6);
+    }
+
+defer:
+    remove(bench_path);
+    bcc_cmd_free(cmd);
+    free(times);
+    return result;
+}
+
+char *bcc_shift_args(int *argc, char ***argv)
+{
+    BCC_ASSERT(*argc > 0);
+    char *result = **argv;
+    (*argv) += 1;
+    (*argc) -= 1;
+    return result;
+}
+
+
+void bcc_log(BCC_Log_Level level, const char *fmt, ...)
+{
+    switch (level) {
+    case BCC_INFO:
+        fprintf(stderr, "[INFO] ");
+        break;
+    case BCC_WARNING:
+        fprintf(stderr, "[WARNING] ");
+        break;
+    case BCC_ERROR:
+        fprintf(stderr, "[ERROR] ");
+        break;
+    default:
+        BCC_ASSERT(0 && "unreachable");
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+}
+
+bool bcc_read_entire_dir(const char *parent, BCC_File_Paths *children)
+{
+    bool result = true;
+    DIR *dir = NULL;
+
+    dir = opendir(parent);
+    if (dir == NULL) {
+        bcc_log(BCC_ERROR, "Could not open directory %s: %s", parent, strerror(errno));
+        bcc_return_defer(false);
+    }
+
+    errno = 0;
+    struct dirent *ent = readdir(dir);
+    while (ent != NULL) {
+        bcc_da_append(children, bcc_temp_strdup(ent->d_name));
+        ent = readdir(dir);
+    }
+
+    if (errno != 0) {
+        bcc_log(BCC_ERROR, "Could not read directory %s: %s", parent, strerror(errno));
+        bcc_return_defer(false);
+    }
+
+defer:
+    if (dir) closedir(dir);
+    return result;
+}
+
+bool bcc_write_entire_file(const char *path, const void *data, size_t size)
+{
+    bool result = true;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        bcc_log(BCC_ERROR, "Could not open file %s for writing: %s\n", path, strerror(errno));
+        bcc_return_defer(false);
+    }
+
+    //           len
+    //           v
+    // aaaaaaaaaa
+    //     ^
+    //     data
+
+    const char *buf = data;
+    while (size > 0) {
+        size_t n = fwrite(buf, 1, size, f);
+        if (ferror(f)) {
+            bcc_log(BCC_ERROR, "Could not write into file %s: %s\n", path, strerror(errno));
+            bcc_return_defer(false);
+        }
+        size -= n;
+        buf  += n;
+    }
+
+defer:
+    if (f) fclose(f);
+    return result;
+}
+
+bool bcc_write_entire_file_if_changed(const char *path, const void *data, size_t size)
+{
+    BCC_String_Builder content = {0};
+    bool same = bcc_file_exists(path) > 0 && bcc_read_entire_file(path, &content) &&
+        content.count == size && (size == 0 || memcmp(content.items, data, size) == 0);
+    bcc_sb_free(content);
+    if (same) return true;
+    return bcc_write_entire_file(path, data, size);
+}
+
+BCC_File_Type bcc_get_file_type(const char *path)
+{
+#ifdef _WIN32
+    DWORD attr = GetFileAttributesA(path);
+    if (attr == INVALID_FILE_ATTRIBUTES) {
+        bcc_log(BCC_ERROR, "Could not get file attributes of %s: %lu", path, GetLastError());
+        return -1;
+    }
+
     if (attr & FILE_ATTRIBUTE_DIRECTORY) return BCC_FILE_DIRECTORY;
     // TODO: detect symlinks on Windows (whatever that means on Windows anyway)
     return BCC_FILE_REGULAR;
 #else // _WIN32
     struct stat statbuf;
-    if (stat(path, &statbuf) < 0) {
-        bcc_log(BCC_ERROR, "Could not get stat of %s: %s", path, strerror(errno));
+    if (stat(path, &statbuf) < 0) {
+        bcc_log(BCC_ERROR, "Could not get stat of %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    switch (statbuf.st_mode & S_IFMT) {
+        case S_IFDIR:  return BCC_FILE_DIRECTORY;
+        case S_IFREG:  return BCC_FILE_REGULAR;
+        case S_IFLNK:  return BCC_FILE_SYMLINK;
+        default:       return BCC_FILE_OTHER;
+    }
+#endif // _WIN32
+}
+
+bool bcc_copy_directory_recursively(const char *src_path, const char *dst_path)
+{
+    bool result = true;
+    BCC_File_Paths children = {0};
+    BCC_String_Builder src_sb = {0};
+    BCC_String_Builder dst_sb = {0};
+    size_t temp_checkpoint = bcc_temp_save();
+
+    BCC_File_Type type = bcc_get_file_type(src_path);
+    if (type < 0) return false;
+
+    switch (type) {
+        case BCC_FILE_DIRECTORY: {
+            if (!bcc_mkdir_if_not_exists(dst_path)) bcc_return_defer(false);
+            if (!bcc_read_entire_dir(src_path, &children)) bcc_return_defer(false);
+
+            for (size_t i = 0; i < children.count; ++i) {
+                if (strcmp(children.items[i], ".") == 0) continue;
+                if (strcmp(children.items[i], "..") == 0) continue;
+
+                src_sb.count = 0;
+                bcc_sb_append_cstr(&src_sb, src_path);
+                bcc_sb_append_cstr(&src_sb, "/");
+                bcc_sb_append_cstr(&src_sb, children.items[i]);
+                bcc_sb_append_null(&src_sb);
+
+                dst_sb.count = 0;
+                bcc_sb_append_cstr(&dst_sb, dst_path);
+                bcc_sb_append_cstr(&dst_sb, "/");
+                bcc_sb_append_cstr(&dst_sb, children.items[i]);
+                bcc_sb_append_null(&dst_sb);
+
+                if (!bcc_copy_directory_recursively(src_sb.items, dst_sb.items)) {
+                    bcc_return_defer(false);
+                }
+            }
+        } break;
+
+        case BCC_FILE_REGULAR: {
+            if (!bcc_copy_file(src_path, dst_path)) {
+                bcc_return_defer(false);
+            }
+        } break;
+
+        case BCC_FILE_SYMLINK: {
+            bcc_log(BCC_WARNING, "TODO: Copying symlinks is not supported yet");
+        } break;
+
+        case BCC_FILE_OTHER: {
+            bcc_log(BCC_ERROR, "Unsupported type of file %s", src_path);
+            bcc_return_defer(false);
+        } break;
+
+        default: BCC_ASSERT(0 && "unreachable");
+    }
+
+defer:
+    bcc_temp_rewind(temp_checkpoint);
+    bcc_da_free(src_sb);
+    bcc_da_free(dst_sb);
+    bcc_da_free(children);
+    return result;
+}
+
+char *bcc_temp_strdup(const char *cstr)
+{
+    size_t n = strlen(cstr);
+    char *result = bcc_temp_alloc(n + 1);
+    BCC_ASSERT(result != NULL && "Increase BCC_TEMP_CAPACITY");
+    memcpy(result, cstr, n);
+    result[n] = '\0';
+    return result;
+}
+
+void *bcc_temp_alloc(size_t size)
+{
+    if (bcc_temp_size + size > BCC_TEMP_CAPACITY) return NULL;
+    void *result = &bcc_temp[bcc_temp_size];
+    bcc_temp_size += size;
+    return result;
+}
+
+char *bcc_temp_sprintf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    BCC_ASSERT(n >= 0);
+    char *result = bcc_temp_alloc(n + 1);
+    BCC_ASSERT(result != NULL && "Extend the size of the temporary allocator");
+    // TODO: use proper arenas for the temporary allocator;
+    va_start(args, format);
+    vsnprintf(result, n + 1, format, args);
+    va_end(args);
+
+    return result;
+}
+
+void bcc_temp_reset(void)
+{
+    bcc_temp_size = 0;
+}
+
+size_t bcc_temp_save(void)
+{
+    return bcc_temp_size;
+}
+
+void bcc_temp_rewind(size_t checkpoint)
+{
+    bcc_temp_size = checkpoint;
+}
+
+const char *bcc_temp_sv_to_cstr(BCC_String_View sv)
+{
+    char *result = bcc_temp_alloc(sv.count + 1);
+    BCC_ASSERT(result != NULL && "Extend the size of the temporary allocator");
+    memcpy(result, sv.data, sv.count);
+    result[sv.count] = '\0';
+    return result;
+}
+
+int bcc_needs_rebuild(const char *output_path, const char **input_paths, size_t input_paths_count)
+{
+#ifdef _WIN32
+    BOOL bSuccess;
+
+    HANDLE output_path_fd = CreateFile(output_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, NULL);
+    if (output_path_fd == INVALID_HANDLE_VALUE) {
+        // NOTE: if output does not exist it 100% must be rebuilt
+        if (GetLastError() == ERROR_FILE_NOT_FOUND) return 1;
+        bcc_log(BCC_ERROR, "Could not open file %s: %lu", output_path, GetLastError());
+        return -1;
+    }
+    FILETIME output_path_time;
+    bSuccess = GetFileTime(output_path_fd, NULL, NULL, &output_path_time);
+    CloseHandle(output_path_fd);
+    if (!bSuccess) {
+        bcc_log(BCC_ERROR, "Could not get time of %s: %lu", output_path, GetLastError());
+        return -1;
+    }
+
+    for (size_t i = 0; i < input_paths_count; ++i) {
+        const char *input_path = input_paths[i];
+        HANDLE input_path_fd = CreateFile(input_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, NULL);
+        if (input_path_fd == INVALID_HANDLE_VALUE) {
+            // NOTE: non-existing input is an error cause it is needed for building in the first place
+            bcc_log(BCC_ERROR, "Could not open file %s: %lu", input_path, GetLastError());
+            return -1;
+        }
+        FILETIME input_path_time;
+        bSuccess = GetFileTime(input_path_fd, NULL, NULL, &input_path_time);
+        CloseHandle(input_path_fd);
+        if (!bSuccess) {
+            bcc_log(BCC_ERROR, "Could not get time of %s: %lu", input_path, GetLastError());
+            return -1;
+        }
+
+        // NOTE: if even a single input_path is fresher than output_path that's 100% rebuild
+        uint64_t input_mtime = (((uint64_t) input_path_time.dwHighDateTime << 32) | input_path_time.dwLowDateTime)*100;
+        uint64_t output_mtime = (((uint64_t) output_path_time.dwHighDateTime << 32) | output_path_time.dwLowDateTime)*100;
+        if (bcc_mtime_is_fresher(input_mtime, output_mtime)) return 1;
+    }
+
+    return 0;
+#else
+    BCC_File_Stat output_stat;
+    int output_exists = bcc_file_stat(output_path, &output_stat);
+    // NOTE: if output does not exist it 100% must be rebuilt
+    if (output_exists <= 0) return output_exists < 0 ? -1 : 1;
+
+    for (size_t i = 0; i < input_paths_count; ++i) {
+        const char *input_path = input_paths[i];
+        BCC_File_Stat input_stat;
+        int input_exists = bcc_file_stat(input_path, &input_stat);
+        if (input_exists < 0) return -1;
+        if (input_exists == 0) {
+            // NOTE: non-existing input is an error cause it is needed for building in the first place
+            bcc_log(BCC_ERROR, "could not stat %s: %s", input_path, strerror(ENOENT));
+            return -1;
+        }
+        // NOTE: if even a single input_path is fresher than output_path that's 100% rebuild
+        if (bcc_mtime_is_fresher(input_stat.mtime, output_stat.mtime)) return 1;
+    }
+
+    return 0;
+#endif
+}
+
+int bcc_needs_rebuild1(const char *output_path, const char *input_path)
+{
+    return bcc_needs_rebuild(output_path, &input_path, 1);
+}
+
+int bcc_needs_rebuild_depfile(const char *output_path, const char *depfile_path, const char **input_paths, size_t input_paths_count)
+{
+    int rebuild_is_needed = bcc_needs_rebuild(output_path, input_paths, input_paths_count);
+    if (rebuild_is_needed != 0) return rebuild_is_needed;
+
+    int depfile_exists = bcc_file_exists(depfile_path);
+    if (depfile_exists <= 0) return depfile_exists < 0 ? -1 : 1;
+
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_File_Paths deps = {0};
+    if (bcc_parse_depfile(depfile_path, &deps)) {
+        for (size_t i = 0; i < deps.count; ++i) {
+            // NOTE: a header that disappeared since the last build is not an error. It just
+            // means the output has to be rebuilt to find out the new set of headers.
+            int dep_exists = bcc_file_exists(deps.items[i]);
+            if (dep_exists <= 0) {
+                rebuild_is_needed = 1;
+                break;
+            }
+        }
+        if (rebuild_is_needed == 0) {
+            rebuild_is_needed = bcc_needs_rebuild(output_path, deps.items, deps.count);
+        }
+    } else {
+        // NOTE: a broken depfile is regenerated by rebuilding the output
+        rebuild_is_needed = 1;
+    }
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
+    return rebuild_is_needed;
+}
+
+bool bcc_parse_depfile(const char *depfile_path, BCC_File_Paths *deps)
+{
+    bool result = true;
+    BCC_String_Builder content = {0};
+    BCC_String_Builder path = {0};
+
+    if (!bcc_read_entire_file(depfile_path, &content)) bcc_return_defer(false);
+
+    // Skip the targets. The separator is the first colon followed by whitespace, so drive
+    // letters of Windows paths (C:/...) are not mistaken for it.
+    BCC_String_View sv = bcc_sv_from_parts(content.items, content.count);
+    while (sv.count > 0) {
+        bcc_sv_chop_by_delim(&sv, ':');
+        if (sv.count == 0 || isspace(sv.data[0])) break;
+    }
+    if (sv.count == 0 && (content.count == 0 || content.items[content.count - 1] != ':')) {
+        bcc_log(BCC_ERROR, "%s: could not find the list of prerequisites", depfile_path);
+        bcc_return_defer(false);
+    }
+
+    // Only the first rule matters. The phony rules of -MP come after it.
+    while (sv.count > 0) {
+        sv = bcc_sv_trim_left(sv);
+        if (sv.count >= 2 && sv.data[0] == '\\' && (sv.data[1] == '\n' || sv.data[1] == '\r')) {
+            sv = bcc_sv_from_parts(sv.data + 1, sv.count - 1);
+            continue;
+        }
+
+        path.count = 0;
+        while (sv.count > 0 && !isspace(sv.data[0])) {
+            char c = sv.data[0];
+            if (c == '\\' && sv.count >= 2 && (sv.data[1] == ' ' || sv.data[1] == '#' || sv.data[1] == '\\')) {
+                c = sv.data[1];
+                sv = bcc_sv_from_parts(sv.data + 1, sv.count - 1);
+            } else if (c == '\\' && sv.count >= 2 && (sv.data[1] == '\n' || sv.data[1] == '\r')) {
+                break;
+            } else if (c == '$' && sv.count >= 2 && sv.data[1] == '$') {
+                sv = bcc_sv_from_parts(sv.data + 1, sv.count - 1);
+            }
+            bcc_da_append(&path, c);
+            sv = bcc_sv_from_parts(sv.data + 1, sv.count - 1);
+        }
+        if (path.count > 0) {
+            bcc_da_append(deps, bcc_temp_sv_to_cstr(bcc_sv_from_parts(path.items, path.count)));
+        }
+
+        // An unescaped new line ends the rule
+        size_t i = 0;
+        while (i < sv.count && (sv.data[i] == ' ' || sv.data[i] == '\t' || sv.data[i] == '\r')) i += 1;
+        if (i < sv.count && sv.data[i] == '\n') break;
+    }
+
+defer:
+    bcc_sb_free(content);
+    bcc_sb_free(path);
+    return result;
+}
+
+// Same as bcc_rename, but without logging every rename
+static bool bcc_rename_quiet(const char *old_path, const char *new_path)
+{
+#ifdef _WIN32
+    if (!MoveFileEx(old_path, new_path, MOVEFILE_REPLACE_EXISTING)) {
+        bcc_log(BCC_ERROR, "could not rename %s to %s: %lu", old_path, new_path, GetLastError());
+        return false;
+    }
+#else
+    if (rename(old_path, new_path) < 0) {
+        bcc_log(BCC_ERROR, "could not rename %s to %s: %s", old_path, new_path, strerror(errno));
+        return false;
+    }
+#endif // _WIN32
+    return true;
+}
+
+bool bcc_rename(const char *old_path, const char *new_path)
+{
+    bcc_log(BCC_INFO, "renaming %s -> %s", old_path, new_path);
+    return bcc_rename_quiet(old_path, new_path);
+}
+
+bool bcc_read_entire_file(const char *path, BCC_String_Builder *sb)
+{
+    bool result = true;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)                 bcc_return_defer(false);
+    if (fseek(f, 0, SEEK_END) < 0) bcc_return_defer(false);
+    long m = ftell(f);
+    if (m < 0)                     bcc_return_defer(false);
+    if (fseek(f, 0, SEEK_SET) < 0) bcc_return_defer(false);
+
+    size_t new_count = sb->count + m;
+    if (new_count > sb->capacity) {
+        sb->items = realloc(sb->items, new_count);
+        BCC_ASSERT(sb->items != NULL && "Buy more RAM lool!!");
+        sb->capacity = new_count;
+    }
+
+    fread(sb->items + sb->count, m, 1, f);
+    if (ferror(f)) {
+        // TODO: Afaik, ferror does not set errno. So the error reporting in defer is not correct in this case.
+        bcc_return_defer(false);
+    }
+    sb->count = new_count;
+
+defer:
+    if (!result) bcc_log(BCC_ERROR, "Could not read file %s: %s", path, strerror(errno));
+    if (f) fclose(f);
+    return result;
+}
+
+BCC_String_View bcc_sv_chop_by_delim(BCC_String_View *sv, char delim)
+{
+    size_t i = 0;
+    while (i < sv->count && sv->data[i] != delim) {
+        i += 1;
+    }
+
+    BCC_String_View result = bcc_sv_from_parts(sv->data, i);
+
+    if (i < sv->count) {
+        sv->count -= i + 1;
+        sv->data  += i + 1;
+    } else {
+        sv->count -= i;
+        sv->data  += i;
+    }
+
+    return result;
+}
+
+BCC_String_View bcc_sv_from_parts(const char *data, size_t count)
+{
+    BCC_String_View sv;
+    sv.count = count;
+    sv.data = data;
+    return sv;
+}
+
+BCC_String_View bcc_sv_trim_left(BCC_String_View sv)
+{
+    size_t i = 0;
+    while (i < sv.count && isspace(sv.data[i])) {
+        i += 1;
+    }
+
+    return bcc_sv_from_parts(sv.data + i, sv.count - i);
+}
+
+BCC_String_View bcc_sv_trim_right(BCC_String_View sv)
+{
+    size_t i = 0;
+    while (i < sv.count && isspace(sv.data[sv.count - 1 - i])) {
+        i += 1;
+    }
+
+    return bcc_sv_from_parts(sv.data, sv.count - i);
+}
+
+BCC_String_View bcc_sv_trim(BCC_String_View sv)
+{
+    return bcc_sv_trim_right(bcc_sv_trim_left(sv));
+}
+
+BCC_String_View bcc_sv_from_cstr(const char *cstr)
+{
+    return bcc_sv_from_parts(cstr, strlen(cstr));
+}
+
+bool bcc_sv_eq(BCC_String_View a, BCC_String_View b)
+{
+    if (a.count != b.count) {
+        return false;
+    } else {
+        return memcmp(a.data, b.data, a.count) == 0;
+    }
+}
+
+// RETURNS:
+//  0 - file does not exists
+//  1 - file exists
+// -1 - error while checking if file exists. The error is logged
+int bcc_file_exists(const char *file_path)
+{
+#if _WIN32
+    // TODO: distinguish between "does not exists" and other errors
+    DWORD dwAttrib = GetFileAttributesA(file_path);
+    return dwAttrib != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat statbuf;
+    if (stat(file_path, &statbuf) < 0) {
+        if (errno == ENOENT) return 0;
+        bcc_log(BCC_ERROR, "Could not check if file %s exists: %s", file_path, strerror(errno));
+        return -1;
+    }
+    return 1;
+#endif
+}
+
+int bcc_file_mtime(const char *file_path, uint64_t *mtime)
+{
+    BCC_File_Stat file_stat;
+    int exists = bcc_file_stat(file_path, &file_stat);
+    if (exists > 0) *mtime = file_stat.mtime;
+    return exists;
+}
+
+int bcc_file_stat(const char *file_path, BCC_File_Stat *file_stat)
+{
+#ifdef _WIN32
+    // NOTE: FILE_FLAG_BACKUP_SEMANTICS lets directories be opened as well
+    HANDLE handle = CreateFileA(file_path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+        if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) return 0;
+        bcc_log(BCC_ERROR, "Could not open file %s: %lu", file_path, error);
         return -1;
     }
+    BY_HANDLE_FILE_INFORMATION info;
+    BOOL ok = GetFileInformationByHandle(handle, &info);
+    CloseHandle(handle);
+    if (!ok) {
+        bcc_log(BCC_ERROR, "Could not get information about %s: %lu", file_path, GetLastError());
+        return -1;
+    }
+    // FILETIME counts 100-nanosecond intervals
+    file_stat->mtime = (((uint64_t) info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime)*100;
+    file_stat->size = ((uint64_t) info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    file_stat->inode = ((uint64_t) info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    file_stat->dev = info.dwVolumeSerialNumber;
+    return 1;
+#elif defined(STATX_MTIME)
+    // NOTE: statx is only asked for what is needed, which may spare network file systems some work
+    struct statx statxbuf;
+    if (statx(AT_FDCWD, file_path, 0, STATX_MTIME | STATX_SIZE | STATX_INO, &statxbuf) < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) return 0;
+        bcc_log(BCC_ERROR, "could not stat %s: %s", file_path, strerror(errno));
+        return -1;
+    }
+    file_stat->mtime = (uint64_t) statxbuf.stx_mtime.tv_sec*1000000000 + statxbuf.stx_mtime.tv_nsec;
+    file_stat->size = statxbuf.stx_size;
+    file_stat->inode = statxbuf.stx_ino;
+    file_stat->dev = ((uint64_t) statxbuf.stx_dev_major << 32) | statxbuf.stx_dev_minor;
+    return 1;
+#else
+    struct stat statbuf;
+    if (stat(file_path, &statbuf) < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) return 0;
+        bcc_log(BCC_ERROR, "could not stat %s: %s", file_path, strerror(errno));
+        return -1;
+    }
+#   if defined(__APPLE__)
+    file_stat->mtime = (uint64_t) statbuf.st_mtimespec.tv_sec*1000000000 + statbuf.st_mtimespec.tv_nsec;
+#   else
+    file_stat->mtime = (uint64_t) statbuf.st_mtim.tv_sec*1000000000 + statbuf.st_mtim.tv_nsec;
+#   endif
+    file_stat->size = statbuf.st_size;
+    file_stat->inode = statbuf.st_ino;
+    file_stat->dev = statbuf.st_dev;
+    return 1;
+#endif // _WIN32
+}
+
+bool bcc_touch(const char *file_path)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(file_path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    BOOL ok = SetFileTime(handle, NULL, NULL, &now);
+    CloseHandle(handle);
+    return ok;
+#else
+    return utimensat(AT_FDCWD, file_path, NULL, 0) == 0;
+#endif // _WIN32
+}
+
+uint64_t bcc_hash_update(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t bcc_hash_cstr(uint64_t hash, const char *cstr)
+{
+    // NOTE: the NULL terminator is hashed too, so a list of strings can not collide with
+    // the same characters split differently
+    return bcc_hash_update(hash, cstr, strlen(cstr) + 1);
+}
+
+#define BCC_DEPS_LOG_MAGIC "BCCDEPS\n"
+#define BCC_DEPS_LOG_VERSION 1
+#define BCC_DEPS_LOG_HEADER_SIZE 16
+#define BCC_DEPS_LOG_DEPS_BIT 0x80000000u
+#define BCC_DEPS_LOG_MAX_RECORD_SIZE (1 << 19)
+
+static size_t bcc_path_table_slot(const BCC_Path_Table *table, const char *path)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = bcc_hash_cstr(BCC_HASH_INIT, path) & mask;
+    while (table->slots[i] != 0) {
+        if (strcmp(table->paths.items[table->slots[i] - 1], path) == 0) break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+bool bcc_path_table_find(const BCC_Path_Table *table, const char *path, uint32_t *id)
+{
+    if (table->capacity == 0) return false;
+    uint32_t slot = table->slots[bcc_path_table_slot(table, path)];
+    if (slot == 0) return false;
+    *id = slot - 1;
+    return true;
+}
+
+uint32_t bcc_path_table_add(BCC_Path_Table *table, const char *path)
+{
+    if ((table->paths.count + 1)*2 > table->capacity) {
+        free(table->slots);
+        table->capacity = table->capacity == 0 ? 256 : table->capacity*2;
+        table->slots = calloc(table->capacity, sizeof(*table->slots));
+        BCC_ASSERT(table->slots != NULL && "Buy more RAM lol");
+        for (size_t id = 0; id < table->paths.count; ++id) {
+            table->slots[bcc_path_table_slot(table, table->paths.items[id])] = id + 1;
+        }
+    }
+
+    size_t slot = bcc_path_table_slot(table, path);
+    BCC_ASSERT(table->slots[slot] == 0 && "The path is already in the table");
+    bcc_da_append(&table->paths, path);
+    table->slots[slot] = table->paths.count;
+    return table->paths.count - 1;
+}
+
+void bcc_path_table_free(BCC_Path_Table *table)
+{
+    bcc_da_free(table->paths);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+static void bcc_deps_log_intern(BCC_Deps_Log *log, const char *path)
+{
+    bcc_path_table_add(&log->paths, path);
+    BCC_Deps_Record none = {0};
+    bcc_da_append(&log->deps, none);
+}
+
+static bool bcc_deps_log_write_record(BCC_Deps_Log *log, FILE *file, uint32_t header, const void *payload, size_t payload_size)
+{
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(payload, payload_size, 1, file) != 1) {
+        bcc_log(BCC_ERROR, "could not write into %s: %s", log->file_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool bcc_deps_log_write_path(BCC_Deps_Log *log, FILE *file, const char *path, uint32_t id)
+{
+    size_t n = strlen(path);
+    size_t padded = (n + 4) & ~(size_t)3;
+    char *payload = bcc_temp_alloc(padded + sizeof(uint32_t));
+    BCC_ASSERT(payload != NULL && "Extend the size of the temporary allocator");
+    memset(payload, 0, padded);
+    memcpy(payload, path, n);
+    uint32_t checksum = ~id;
+    memcpy(payload + padded, &checksum, sizeof(checksum));
+    return bcc_deps_log_write_record(log, file, padded + sizeof(checksum), payload, padded + sizeof(checksum));
+}
+
+static bool bcc_deps_log_write_deps(BCC_Deps_Log *log, FILE *file, uint32_t output_id, uint64_t mtime, const uint32_t *ids, size_t count)
+{
+    // NOTE: the temporary allocator does not align anything, so the words are copied in
+    size_t payload_size = (3 + count)*sizeof(uint32_t);
+    char *payload = bcc_temp_alloc(payload_size);
+    BCC_ASSERT(payload != NULL && "Extend the size of the temporary allocator");
+    uint32_t words[3] = { output_id, (uint32_t) mtime, (uint32_t) (mtime >> 32) };
+    memcpy(payload, words, sizeof(words));
+    memcpy(payload + sizeof(words), ids, count*sizeof(uint32_t));
+    return bcc_deps_log_write_record(log, file, payload_size | BCC_DEPS_LOG_DEPS_BIT, payload, payload_size);
+}
+
+static bool bcc_deps_log_load(BCC_Deps_Log *log)
+{
+    const char *file_path = log->file_path;
+#ifdef _WIN32
+    BCC_String_Builder content = {0};
+    int exists = bcc_file_exists(file_path);
+    if (exists <= 0) return exists == 0;
+    if (!bcc_read_entire_file(file_path, &content)) return false;
+    log->mapping = content.items;
+    log->mapping_size = content.count;
+#else
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return true;
+        bcc_log(BCC_ERROR, "could not open %s: %s", file_path, strerror(errno));
+        return false;
+    }
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0) {
+        bcc_log(BCC_ERROR, "could not stat %s: %s", file_path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    if (statbuf.st_size > 0) {
+        void *mapping = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            bcc_log(BCC_ERROR, "could not map %s into memory: %s", file_path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        log->mapping = mapping;
+        log->mapping_size = statbuf.st_size;
+    }
+    close(fd);
+#endif // _WIN32
+
+    const char *data = log->mapping;
+    size_t size = log->mapping_size;
+    if (size == 0) return true;
+
+    uint32_t version = 0;
+    if (size >= BCC_DEPS_LOG_HEADER_SIZE) memcpy(&version, data + 8, sizeof(version));
+    if (size < BCC_DEPS_LOG_HEADER_SIZE || memcmp(data, BCC_DEPS_LOG_MAGIC, 8) != 0 || version != BCC_DEPS_LOG_VERSION) {
+        bcc_log(BCC_WARNING, "%s is in an unknown format, discarding it", file_path);
+        return true;
+    }
+
+    size_t offset = BCC_DEPS_LOG_HEADER_SIZE;
+    while (offset + sizeof(uint32_t) <= size) {
+        uint32_t header;
+        memcpy(&header, data + offset, sizeof(header));
+        bool is_deps = header & BCC_DEPS_LOG_DEPS_BIT;
+        size_t payload_size = header & ~BCC_DEPS_LOG_DEPS_BIT;
+        const char *payload = data + offset + sizeof(header);
+        if (payload_size % 4 != 0 || payload_size > BCC_DEPS_LOG_MAX_RECORD_SIZE ||
+            offset + sizeof(header) + payload_size > size) break;
+
+        if (is_deps) {
+            if (payload_size < 3*sizeof(uint32_t)) break;
+            const uint32_t *words = (const uint32_t*) payload;
+            uint32_t output_id = words[0];
+            uint32_t count = payload_size/sizeof(uint32_t) - 3;
+            bool valid = output_id < log->paths.paths.count;
+            for (uint32_t i = 0; valid && i < count; ++i) valid = words[3 + i] < log->paths.paths.count;
+            if (!valid) break;
+            BCC_Deps_Record *record = &log->deps.items[output_id];
+            record->mtime = (uint64_t) words[1] | ((uint64_t) words[2] << 32);
+            record->ids = words + 3;
+            record->count = count;
+            log->records += 1;
+        } else {
+            if (payload_size < 2*sizeof(uint32_t)) break;
+            const char *path = payload;
+            uint32_t checksum;
+            memcpy(&checksum, payload + payload_size - sizeof(checksum), sizeof(checksum));
+            if (path[payload_size - sizeof(checksum) - 1] != '\0') break;
+            if (~checksum != log->paths.paths.count) break;
+            bcc_deps_log_intern(log, path);
+        }
+
+        offset += sizeof(header) + payload_size;
+    }
+    log->loaded_paths = log->paths.paths.count;
+
+    if (offset != size) {
+        // NOTE: most likely the build got interrupted in the middle of writing a record.
+        // Everything before it is still good, so only the tail is thrown away.
+        bcc_log(BCC_WARNING, "%s is corrupted, truncating it to %zu bytes", file_path, offset);
+        const char *temp_path = bcc_temp_sprintf("%s.tmp", file_path);
+        if (!bcc_write_entire_file(temp_path, data, offset)) return false;
+        if (!bcc_rename(temp_path, file_path)) return false;
+    }
+
+    return true;
+}
+
+bool bcc_deps_log_open(BCC_Deps_Log *log, const char *file_path)
+{
+    memset(log, 0, sizeof(*log));
+    log->file_path = file_path;
+    if (!bcc_deps_log_load(log)) return false;
+
+    bool fresh = log->loaded_paths == 0 && log->records == 0;
+    log->file = fopen(file_path, fresh ? "wb" : "ab");
+    if (log->file == NULL) {
+        bcc_log(BCC_ERROR, "could not open %s for writing: %s", file_path, strerror(errno));
+        return false;
+    }
+    if (fresh) {
+        char header[BCC_DEPS_LOG_HEADER_SIZE] = BCC_DEPS_LOG_MAGIC;
+        uint32_t version = BCC_DEPS_LOG_VERSION;
+        memcpy(header + 8, &version, sizeof(version));
+        if (fwrite(header, sizeof(header), 1, log->file) != 1) {
+            bcc_log(BCC_ERROR, "could not write into %s: %s", file_path, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+const BCC_Deps_Record *bcc_deps_log_lookup(const BCC_Deps_Log *log, const char *output_path)
+{
+    uint32_t id = 0;
+    if (!bcc_path_table_find(&log->paths, output_path, &id)) return NULL;
+    const BCC_Deps_Record *record = &log->deps.items[id];
+    if (record->ids == NULL) return NULL;
+    return record;
+}
+
+static uint32_t bcc_deps_log_get_id(BCC_Deps_Log *log, const char *path, bool *ok)
+{
+    uint32_t id = 0;
+    if (bcc_path_table_find(&log->paths, path, &id)) return id;
+
+    char *owned = strdup(path);
+    BCC_ASSERT(owned != NULL && "Buy more RAM lol");
+    bcc_deps_log_intern(log, owned);
+    id = log->paths.paths.count - 1;
+    if (!bcc_deps_log_write_path(log, log->file, owned, id)) *ok = false;
+    return id;
+}
+
+bool bcc_deps_log_record(BCC_Deps_Log *log, const char *output_path, uint64_t mtime, const char **deps, size_t deps_count)
+{
+    bool ok = true;
+    size_t temp_checkpoint = bcc_temp_save();
+    uint32_t output_id = bcc_deps_log_get_id(log, output_path, &ok);
+    uint32_t *ids = malloc((deps_count + 1)*sizeof(*ids));
+    BCC_ASSERT(ids != NULL && "Buy more RAM lol");
+    for (size_t i = 0; i < deps_count; ++i) {
+        ids[i] = bcc_deps_log_get_id(log, deps[i], &ok);
+    }
+
+    // Nothing has changed, so there is no reason to grow the log
+    const BCC_Deps_Record *old = &log->deps.items[output_id];
+    if (old->ids != NULL && old->mtime == mtime && old->count == deps_count &&
+        memcmp(old->ids, ids, deps_count*sizeof(*ids)) == 0) {
+        free(ids);
+        bcc_temp_rewind(temp_checkpoint);
+        return ok;
+    }
+
+    if (!bcc_deps_log_write_deps(log, log->file, output_id, mtime, ids, deps_count)) ok = false;
+    if (fflush(log->file) != 0) ok = false;
+    bcc_temp_rewind(temp_checkpoint);
+
+    // NOTE: records that live in the mapping are not owned, everything else is
+    BCC_Deps_Record *record = &log->deps.items[output_id];
+    const char *mapping = log->mapping;
+    if (record->ids != NULL && !((const char*) record->ids >= mapping && (const char*) record->ids < mapping + log->mapping_size)) {
+        free((void*) record->ids);
+    }
+    record->mtime = mtime;
+    record->ids = ids;
+    record->count = deps_count;
+    log->records += 1;
+    return ok;
+}
+
+static bool bcc_deps_log_compact(BCC_Deps_Log *log)
+{
+    bool result = true;
+    const char *temp_path = bcc_temp_sprintf("%s.tmp", log->file_path);
+    uint32_t *new_ids = calloc(log->paths.paths.count, sizeof(*new_ids));
+    BCC_ASSERT(new_ids != NULL && "Buy more RAM lol");
+    uint32_t *ids = NULL; // The record being written, with the output id at the end
+    size_t ids_capacity = 0;
+    uint32_t next_id = 0;
+    size_t records = 0;
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        bcc_log(BCC_ERROR, "could not open %s for writing: %s", temp_path, strerror(errno));
+        bcc_return_defer(false);
+    }
+    char header[BCC_DEPS_LOG_HEADER_SIZE] = BCC_DEPS_LOG_MAGIC;
+    uint32_t version = BCC_DEPS_LOG_VERSION;
+    memcpy(header + 8, &version, sizeof(version));
+    if (fwrite(header, sizeof(header), 1, file) != 1) bcc_return_defer(false);
+
+    // new_ids[old id] is the new id + 1, 0 when the path was not written yet
+    for (size_t id = 0; id < log->deps.count; ++id) {
+        const BCC_Deps_Record *record = &log->deps.items[id];
+        if (record->ids == NULL) continue;
+
+        size_t temp_checkpoint = bcc_temp_save();
+        if (ids_capacity < record->count + 1) {
+            ids_capacity = record->count + 1;
+            ids = realloc(ids, ids_capacity*sizeof(*ids));
+            BCC_ASSERT(ids != NULL && "Buy more RAM lol");
+        }
+        for (size_t i = 0; i <= record->count; ++i) {
+            uint32_t old_id = i < record->count ? record->ids[i] : id;
+            if (new_ids[old_id] == 0) {
+                if (!bcc_deps_log_write_path(log, file, log->paths.paths.items[old_id], next_id)) bcc_return_defer(false);
+                new_ids[old_id] = ++next_id;
+            }
+            ids[i] = new_ids[old_id] - 1;
+        }
+        if (!bcc_deps_log_write_deps(log, file, ids[record->count], record->mtime, ids, record->count)) bcc_return_defer(false);
+        records += 1;
+        bcc_temp_rewind(temp_checkpoint);
+    }
+
+    if (fclose(file) != 0) {
+        file = NULL;
+        bcc_return_defer(false);
+    }
+    file = NULL;
+    if (!bcc_rename(temp_path, log->file_path)) bcc_return_defer(false);
+    log->records = records;
+
+defer:
+    if (file) fclose(file);
+    if (!result) bcc_log(BCC_ERROR, "could not compact %s", log->file_path);
+    free(new_ids);
+    free(ids);
+    return result;
+}
+
+bool bcc_deps_log_close(BCC_Deps_Log *log)
+{
+    bool result = true;
+    if (log->file) {
+        if (fclose(log->file) != 0) {
+            bcc_log(BCC_ERROR, "could not write into %s: %s", log->file_path, strerror(errno));
+            result = false;
+        }
+        log->file = NULL;
+    }
+
+    size_t live = 0;
+    for (size_t id = 0; id < log->deps.count; ++id) {
+        if (log->deps.items[id].ids != NULL) live += 1;
+    }
+    if (result && log->records > BCC_DEPS_LOG_COMPACT_MIN && log->records > 3*live) {
+        result = bcc_deps_log_compact(log);
+    }
+
+    const char *mapping = log->mapping;
+    for (size_t id = 0; id < log->deps.count; ++id) {
+        const char *ids = (const char*) log->deps.items[id].ids;
+        if (ids != NULL && !(ids >= mapping && ids < mapping + log->mapping_size)) free((void*) ids);
+    }
+    for (size_t id = log->loaded_paths; id < log->paths.paths.count; ++id) {
+        free((void*) log->paths.paths.items[id]);
+    }
+#ifdef _WIN32
+    free(log->mapping);
+#else
+    if (log->mapping) munmap(log->mapping, log->mapping_size);
+#endif // _WIN32
+    bcc_path_table_free(&log->paths);
+    bcc_da_free(log->deps);
+    memset(log, 0, sizeof(*log));
+    return result;
+}
+
+#define BCC_BUILD_LOG_HEADER "# bcc log v1\n"
+
+static bool bcc_build_log_write_entry(FILE *file, const char *output_path, const BCC_Build_Log_Entry *entry)
+{
+    return fprintf(file, "%s\t%016llx\t%llu\t%llu\t%llu\t%016llx\n", output_path, (unsigned long long) entry->cmd_hash,
+                   (unsigned long long) entry->cpu_us, (unsigned long long) entry->max_rss_kb,
+                   (unsigned long long) entry->wall_us, (unsigned long long) entry->inputs_hash) >= 0;
+}
+
+// Missing or empty fields read as 0
+static uint64_t bcc_build_log_field(BCC_String_View *line, int base)
+{
+    BCC_String_View field = bcc_sv_chop_by_delim(line, '\t');
+    if (field.count == 0) return 0;
+    // NOTE: every field is followed by either a tab or a new line, so strtoull stops there
+    return strtoull(field.data, NULL, base);
+}
+
+static void bcc_build_log_set(BCC_Build_Log *log, const char *output_path, BCC_Build_Log_Entry entry, bool copy)
+{
+    uint32_t id = 0;
+    if (!bcc_path_table_find(&log->outputs, output_path, &id)) {
+        if (copy) {
+            output_path = strdup(output_path);
+            BCC_ASSERT(output_path != NULL && "Buy more RAM lol");
+        }
+        id = bcc_path_table_add(&log->outputs, output_path);
+        BCC_Build_Log_Entry none = {0};
+        bcc_da_append(&log->entries, none);
+    }
+    log->entries.items[id] = entry;
+}
+
+bool bcc_build_log_open(BCC_Build_Log *log, const char *file_path)
+{
+    memset(log, 0, sizeof(*log));
+    log->file_path = file_path;
+
+    int exists = bcc_file_exists(file_path);
+    if (exists < 0) return false;
+    if (exists && !bcc_read_entire_file(file_path, &log->content)) return false;
+
+    BCC_String_View header = bcc_sv_from_cstr(BCC_BUILD_LOG_HEADER);
+    BCC_String_View sv = bcc_sv_from_parts(log->content.items, log->content.count);
+    bool fresh = sv.count < header.count || !bcc_sv_eq(bcc_sv_from_parts(sv.data, header.count), header);
+    if (!fresh) {
+        sv = bcc_sv_from_parts(sv.data + header.count, sv.count - header.count);
+        while (sv.count > 0) {
+            BCC_String_View line = bcc_sv_chop_by_delim(&sv, '\n');
+            // NOTE: the last line is incomplete if the build got interrupted while writing it
+            if (sv.count == 0 && line.data + line.count == log->content.items + log->content.count) break;
+
+            BCC_String_View output = bcc_sv_chop_by_delim(&line, '\t');
+            if (output.count == 0) continue;
+            BCC_Build_Log_Entry entry = {0};
+            entry.cmd_hash = bcc_build_log_field(&line, 16);
+            entry.cpu_us = bcc_build_log_field(&line, 10);
+            entry.max_rss_kb = bcc_build_log_field(&line, 10);
+            entry.wall_us = bcc_build_log_field(&line, 10);
+            entry.inputs_hash = bcc_build_log_field(&line, 16);
+
+            // Terminate the output in place, the content buffer lives as long as the log
+            ((char*) output.data)[output.count] = '\0';
+            bcc_build_log_set(log, output.data, entry, false);
+            log->lines += 1;
+        }
+        log->loaded_outputs = log->outputs.paths.count;
+    }
+
+    log->file = fopen(file_path, fresh ? "wb" : "ab");
+    if (log->file == NULL) {
+        bcc_log(BCC_ERROR, "could not open %s for writing: %s", file_path, strerror(errno));
+        return false;
+    }
+    if (fresh && fputs(BCC_BUILD_LOG_HEADER, log->file) < 0) {
+        bcc_log(BCC_ERROR, "could not write into %s: %s", file_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+const BCC_Build_Log_Entry *bcc_build_log_lookup(const BCC_Build_Log *log, const char *output_path)
+{
+    uint32_t id = 0;
+    if (!bcc_path_table_find(&log->outputs, output_path, &id)) return NULL;
+    return &log->entries.items[id];
+}
+
+bool bcc_build_log_record(BCC_Build_Log *log, const char *output_path, BCC_Build_Log_Entry entry)
+{
+    bcc_build_log_set(log, output_path, entry, true);
+    log->lines += 1;
+    if (!bcc_build_log_write_entry(log->file, output_path, &entry) || fflush(log->file) != 0) {
+        bcc_log(BCC_ERROR, "could not write into %s: %s", log->file_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool bcc_build_log_compact(BCC_Build_Log *log)
+{
+    bool result = true;
+    const char *temp_path = bcc_temp_sprintf("%s.tmp", log->file_path);
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) bcc_return_defer(false);
+    if (fputs(BCC_BUILD_LOG_HEADER, file) < 0) bcc_return_defer(false);
+    for (size_t id = 0; id < log->entries.count; ++id) {
+        if (!bcc_build_log_write_entry(file, log->outputs.paths.items[id], &log->entries.items[id])) bcc_return_defer(false);
+    }
+    if (fclose(file) != 0) {
+        file = NULL;
+        bcc_return_defer(false);
+    }
+    file = NULL;
+    if (!bcc_rename(temp_path, log->file_path)) bcc_return_defer(false);
+    log->lines = log->entries.count;
+
+defer:
+    if (file) fclose(file);
+    if (!result) bcc_log(BCC_ERROR, "could not compact %s: %s", log->file_path, strerror(errno));
+    return result;
+}
+
+bool bcc_build_log_close(BCC_Build_Log *log)
+{
+    bool result = true;
+    if (log->file) {
+        if (fclose(log->file) != 0) {
+            bcc_log(BCC_ERROR, "could not write into %s: %s", log->file_path, strerror(errno));
+            result = false;
+        }
+        log->file = NULL;
+    }
+
+    if (result && log->lines > BCC_DEPS_LOG_COMPACT_MIN && log->lines > 3*log->entries.count) {
+        result = bcc_build_log_compact(log);
+    }
+
+    for (size_t id = log->loaded_outputs; id < log->outputs.paths.count; ++id) {
+        free((void*) log->outputs.paths.items[id]);
+    }
+    bcc_path_table_free(&log->outputs);
+    bcc_da_free(log->entries);
+    bcc_sb_free(log->content);
+    memset(log, 0, sizeof(*log));
+    return result;
+}
+
+typedef struct {
+    BCC_File_Stat stat;
+    uint64_t hash;
+} BCC_File_Hash;
+
+// Content hashes of the files, see bcc_file_hash. Loaded from BCC_HASH_CACHE_PATH on first use
+static struct {
+    bool loaded;
+    bool dirty;           // There are hashes the file does not have yet
+    BCC_Path_Table paths; // Owns the paths
+    struct {
+        BCC_File_Hash *items;
+        size_t count;
+        size_t capacity;
+    } entries;            // id of path -> its hash
+} bcc_file_hashes = {0};
+
+#define BCC_HASH_CACHE_HEADER "# bcc hashes v1\n"
+
+static BCC_File_Hash *bcc_file_hashes_entry(const char *file_path)
+{
+    uint32_t id = 0;
+    if (!bcc_path_table_find(&bcc_file_hashes.paths, file_path, &id)) {
+        char *path = strdup(file_path);
+        BCC_ASSERT(path != NULL && "Buy more RAM lol");
+        id = bcc_path_table_add(&bcc_file_hashes.paths, path);
+        BCC_File_Hash none = {0};
+        bcc_da_append(&bcc_file_hashes.entries, none);
+    }
+    return &bcc_file_hashes.entries.items[id];
+}
+
+static void bcc_file_hashes_load(void)
+{
+    if (bcc_file_hashes.loaded) return;
+    bcc_file_hashes.loaded = true;
+
+    BCC_String_Builder content = {0};
+    if (bcc_file_exists(BCC_HASH_CACHE_PATH) <= 0 || !bcc_read_entire_file(BCC_HASH_CACHE_PATH, &content)) return;
+    BCC_String_View header = bcc_sv_from_cstr(BCC_HASH_CACHE_HEADER);
+    BCC_String_View sv = bcc_sv_from_parts(content.items, content.count);
+    if (sv.count >= header.count && bcc_sv_eq(bcc_sv_from_parts(sv.data, header.count), header)) {
+        sv = bcc_sv_from_parts(sv.data + header.count, sv.count - header.count);
+        while (sv.count > 0) {
+            BCC_String_View line = bcc_sv_chop_by_delim(&sv, '\n');
+            BCC_String_View path = bcc_sv_chop_by_delim(&line, '\t');
+            if (path.count == 0 || line.count == 0) continue;
+            BCC_File_Hash entry = {0};
+            entry.stat.dev = bcc_build_log_field(&line, 16);
+            entry.stat.inode = bcc_build_log_field(&line, 16);
+            entry.stat.size = bcc_build_log_field(&line, 10);
+            entry.stat.mtime = bcc_build_log_field(&line, 10);
+            entry.hash = bcc_build_log_field(&line, 16);
+            ((char*) path.data)[path.count] = '\0';
+            *bcc_file_hashes_entry(path.data) = entry;
+        }
+    }
+    bcc_sb_free(content);
+}
+
+bool bcc_file_hashes_save(void)
+{
+    if (!bcc_file_hashes.dirty) return true;
+
+    bool result = true;
+    FILE *file = NULL;
+    size_t temp_checkpoint = bcc_temp_save();
+#ifdef _WIN32
+    const char *temp_path = bcc_temp_sprintf("%s.%lu.tmp", BCC_HASH_CACHE_PATH, GetCurrentProcessId());
+#else
+    const char *temp_path = bcc_temp_sprintf("%s.%d.tmp", BCC_HASH_CACHE_PATH, (int) getpid());
+#endif // _WIN32
+    file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        // NOTE: the build directory does not exist yet while the build script rebuilds itself
+        // the very first time. The hashes are computed again next time, that is all.
+        if (errno != ENOENT) bcc_log(BCC_WARNING, "could not open %s for writing: %s", temp_path, strerror(errno));
+        bcc_return_defer(false);
+    }
+    fputs(BCC_HASH_CACHE_HEADER, file);
+    for (size_t id = 0; id < bcc_file_hashes.entries.count; ++id) {
+        const BCC_File_Hash *entry = &bcc_file_hashes.entries.items[id];
+        if (entry->stat.mtime == 0) continue;
+        fprintf(file, "%s\t%llx\t%llx\t%llu\t%llu\t%016llx\n", bcc_file_hashes.paths.paths.items[id],
+                (unsigned long long) entry->stat.dev, (unsigned long long) entry->stat.inode,
+                (unsigned long long) entry->stat.size, (unsigned long long) entry->stat.mtime,
+                (unsigned long long) entry->hash);
+    }
+    if (ferror(file)) {
+        bcc_log(BCC_WARNING, "could not write %s: %s", temp_path, strerror(errno));
+        bcc_return_defer(false);
+    }
+    fclose(file);
+    file = NULL;
+    if (!bcc_rename_quiet(temp_path, BCC_HASH_CACHE_PATH)) bcc_return_defer(false);
+    bcc_file_hashes.dirty = false;
+
+defer:
+    if (file) fclose(file);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+// Current time in the same units as BCC_File_Stat.mtime
+static uint64_t bcc_file_time_now(void)
+{
+#ifdef _WIN32
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    return (((uint64_t) now.dwHighDateTime << 32) | now.dwLowDateTime)*100;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t) now.tv_sec*1000000000 + now.tv_nsec;
+#endif // _WIN32
+}
+
+// Whether an input with input_mtime makes an output with output_mtime stale. The same
+// mtime only counts while the output is still racy: the kernel updates mtimes with a coarse
+// clock, so an input saved right after the output was written may end up in the same tick.
+static bool bcc_mtime_is_fresher(uint64_t input_mtime, uint64_t output_mtime)
+{
+    if (input_mtime != output_mtime) return input_mtime > output_mtime;
+    return output_mtime + BCC_HASH_CACHE_RACY_NS > bcc_file_time_now();
+}
+
+bool bcc_file_hash(const char *file_path, uint64_t *hash)
+{
+    bcc_file_hashes_load();
+    BCC_File_Stat file_stat;
+    if (bcc_file_stat(file_path, &file_stat) <= 0) return false;
+
+    BCC_File_Hash *entry = bcc_file_hashes_entry(file_path);
+    if (memcmp(&entry->stat, &file_stat, sizeof(file_stat)) != 0) {
+        if (!bcc_hash_file(file_path, &entry->hash)) {
+            // NOTE: forget the stat, so the file is read again next time
+            memset(&entry->stat, 0, sizeof(entry->stat));
+            return false;
+        }
+        // NOTE: a file that has been modified just now may be modified again within the same
+        // tick of the clock the mtimes come from, without any change of its stat. Its hash
+        // is only trusted once it is old enough, until then the file is read every time.
+        if (file_stat.mtime + BCC_HASH_CACHE_RACY_NS <= bcc_file_time_now()) {
+            entry->stat = file_stat;
+            bcc_file_hashes.dirty = true;
+        } else {
+            memset(&entry->stat, 0, sizeof(entry->stat));
+        }
+    }
+    *hash = entry->hash;
+    return true;
+}
+
+uint64_t bcc_cmd_hash(BCC_Cmd cmd)
+{
+    uint64_t hash = BCC_HASH_INIT;
+    for (size_t i = 0; i < cmd.count; ++i) {
+        hash = bcc_hash_cstr(hash, cmd.items[i]);
+    }
+    return hash;
+}
+
+bool bcc_hash_file(const char *file_path, uint64_t *hash)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) return false;
+
+    static char buf[64*1024];
+    uint64_t result = BCC_HASH_INIT;
+    for (;;) {
+        size_t n = fread(buf, 1, sizeof(buf), f);
+        result = bcc_hash_update(result, buf, n);
+        if (n < sizeof(buf)) break;
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    if (ok) *hash = result;
+    return ok;
+}
+
+uint64_t bcc_compiler_identity(const char *compiler)
+{
+    typedef struct {
+        char *compiler;
+        uint64_t identity;
+    } Known;
+    static struct {
+        Known *items;
+        size_t count;
+        size_t capacity;
+    } known = {0};
+
+    for (size_t i = 0; i < known.count; ++i) {
+        if (strcmp(known.items[i].compiler, compiler) == 0) return known.items[i].identity;
+    }
+
+    uint64_t identity = bcc_hash_cstr(BCC_HASH_INIT, compiler);
+    size_t temp_checkpoint = bcc_temp_save();
+    const char *resolved = NULL;
+    if (strchr(compiler, '/') || strchr(compiler, '\\')) {
+        if (bcc_file_exists(compiler) > 0) resolved = compiler;
+    } else {
+        const char *path_env = getenv("PATH");
+#ifdef _WIN32
+        char separator = ';';
+#else
+        char separator = ':';
+#endif // _WIN32
+        BCC_String_View path = bcc_sv_from_cstr(path_env ? path_env : "");
+        while (path.count > 0 && resolved == NULL) {
+            BCC_String_View dir = bcc_sv_chop_by_delim(&path, separator);
+            if (dir.count == 0) continue;
+            const char *candidate = bcc_temp_sprintf(SV_Fmt"/%s", SV_Arg(dir), compiler);
+            if (bcc_file_exists(candidate) > 0) resolved = candidate;
+#ifdef _WIN32
+            candidate = bcc_temp_sprintf("%s.exe", candidate);
+            if (resolved == NULL && bcc_file_exists(candidate) > 0) resolved = candidate;
+#endif // _WIN32
+        }
+    }
+
+    if (resolved != NULL) {
+#ifndef _WIN32
+        // NOTE: `cc` and friends are usually symlinks to the actual compiler
+        char *real = realpath(resolved, NULL);
+        if (real != NULL) {
+            resolved = bcc_temp_strdup(real);
+            free(real);
+        }
+#endif // _WIN32
+        uint64_t mtime = 0;
+        identity = bcc_hash_cstr(identity, resolved);
+        if (bcc_file_mtime(resolved, &mtime) > 0) identity = bcc_hash_update(identity, &mtime, sizeof(mtime));
+        FILE *f = fopen(resolved, "rb");
+        if (f != NULL) {
+            if (fseek(f, 0, SEEK_END) == 0) {
+                long size = ftell(f);
+                identity = bcc_hash_update(identity, &size, sizeof(size));
+            }
+            fclose(f);
+        }
+    } else {
+        bcc_log(BCC_WARNING, "could not find compiler %s in PATH", compiler);
+    }
+    bcc_temp_rewind(temp_checkpoint);
+
+    // NOTE: the caller's string may be gone by the next call, the memo keeps its own copy
+    Known entry = { strdup(compiler), identity };
+    BCC_ASSERT(entry.compiler != NULL && "Buy more RAM lol");
+    bcc_da_append(&known, entry);
+    return identity;
+}
+
+static bool bcc_fingerprint(BCC_Cmd cmd, const char *depfile_path, uint64_t *fingerprint)
+{
+    bool result = true;
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_File_Paths deps = {0};
+
+    uint64_t hash = bcc_hash_cstr(BCC_HASH_INIT, "bcc fingerprint v1");
+    uint64_t identity = bcc_compiler_identity(cmd.items[0]);
+    hash = bcc_hash_update(hash, &identity, sizeof(identity));
+    uint64_t cmd_hash = bcc_cmd_hash(cmd);
+    hash = bcc_hash_update(hash, &cmd_hash, sizeof(cmd_hash));
+
+    if (bcc_file_exists(depfile_path) <= 0) bcc_return_defer(false);
+    if (!bcc_parse_depfile(depfile_path, &deps)) bcc_return_defer(false);
+    for (size_t i = 0; i < deps.count; ++i) {
+        uint64_t content = 0;
+        if (!bcc_file_hash(deps.items[i], &content)) bcc_return_defer(false);
+        hash = bcc_hash_cstr(hash, deps.items[i]);
+        hash = bcc_hash_update(hash, &content, sizeof(content));
+    }
+    *fingerprint = hash;
+    bcc_file_hashes_save();
+
+defer:
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+int bcc_needs_rebuild_fingerprint(const char *output_path, BCC_Cmd cmd, const char *depfile_path)
+{
+    int result = 1;
+    BCC_String_Builder stored = {0};
+    size_t temp_checkpoint = bcc_temp_save();
+    const char *fp_path = bcc_temp_sprintf("%s.fp", output_path);
+
+    if (bcc_file_exists(output_path) <= 0 || bcc_file_exists(fp_path) <= 0) bcc_return_defer(1);
+    if (!bcc_read_entire_file(fp_path, &stored)) bcc_return_defer(1);
+    bcc_sb_append_null(&stored);
+
+    uint64_t fingerprint = 0;
+    if (!bcc_fingerprint(cmd, depfile_path, &fingerprint)) bcc_return_defer(1);
+    if (strtoull(stored.items, NULL, 16) == fingerprint) result = 0;
+
+defer:
+    bcc_sb_free(stored);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+bool bcc_fingerprint_store(const char *output_path, BCC_Cmd cmd, const char *depfile_path)
+{
+    uint64_t fingerprint = 0;
+    if (!bcc_fingerprint(cmd, depfile_path, &fingerprint)) {
+        bcc_log(BCC_WARNING, "could not fingerprint %s, it is going to be rebuilt next time", output_path);
+        return false;
+    }
+    size_t temp_checkpoint = bcc_temp_save();
+    const char *content = bcc_temp_sprintf("%016llx\n", (unsigned long long) fingerprint);
+    bool result = bcc_write_entire_file(bcc_temp_sprintf("%s.fp", output_path), content, strlen(content));
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+const char *bcc_cache_dir(void)
+{
+    if (bcc_options.no_cache) return NULL;
+    if (bcc_options.cache_dir) return bcc_options.cache_dir;
+    const char *dir = getenv("BCC_CACHE_DIR");
+    if (dir && *dir) return dir;
+    return BCC_CACHE_DEFAULT_DIR;
+}
+
+uint64_t bcc_cache_max_size(void)
+{
+    if (bcc_options.cache_size) return bcc_options.cache_size;
+    uint64_t size = 0;
+    const char *env = getenv("BCC_CACHE_SIZE");
+    if (env && *env) {
+        if (bcc_parse_size(env, &size)) return size;
+        bcc_log(BCC_WARNING, "invalid BCC_CACHE_SIZE `%s`", env);
+    }
+    return BCC_CACHE_DEFAULT_SIZE;
+}
+
+#ifdef _WIN32
+typedef HANDLE BCC_Cache_Lock;
+#define BCC_CACHE_INVALID_LOCK INVALID_HANDLE_VALUE
+#else
+typedef int BCC_Cache_Lock;
+#define BCC_CACHE_INVALID_LOCK (-1)
+#endif // _WIN32
+
+// Take the exclusive lock of the whole cache. Blocks until the other builds release it.
+static BCC_Cache_Lock bcc_cache_lock(const BCC_Cache *cache)
+{
+    const char *lock_path = bcc_temp_sprintf("%s/lock", cache->dir);
+#ifdef _WIN32
+    HANDLE lock = CreateFileA(lock_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (lock == INVALID_HANDLE_VALUE) {
+        bcc_log(BCC_ERROR, "could not open %s: %lu", lock_path, GetLastError());
+        return BCC_CACHE_INVALID_LOCK;
+    }
+    OVERLAPPED overlapped = {0};
+    if (!LockFileEx(lock, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+        bcc_log(BCC_ERROR, "could not lock %s: %lu", lock_path, GetLastError());
+        CloseHandle(lock);
+        return BCC_CACHE_INVALID_LOCK;
+    }
+    return lock;
+#else
+    int lock = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0) {
+        bcc_log(BCC_ERROR, "could not open %s: %s", lock_path, strerror(errno));
+        return BCC_CACHE_INVALID_LOCK;
+    }
+    while (flock(lock, LOCK_EX) < 0) {
+        if (errno == EINTR) continue;
+        bcc_log(BCC_ERROR, "could not lock %s: %s", lock_path, strerror(errno));
+        close(lock);
+        return BCC_CACHE_INVALID_LOCK;
+    }
+    return lock;
+#endif // _WIN32
+}
+
+static void bcc_cache_unlock(BCC_Cache_Lock lock)
+{
+#ifdef _WIN32
+    CloseHandle(lock);
+#else
+    // NOTE: closing the descriptor releases the flock
+    close(lock);
+#endif // _WIN32
+}
+
+// Write a file of the cache so nobody can ever observe it half written
+static bool bcc_cache_write_atomic(const BCC_Cache *cache, const char *path, const char *src_path, const void *data, size_t size)
+{
+    static unsigned counter = 0;
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = getpid();
+#endif // _WIN32
+    const char *temp_path = bcc_temp_sprintf("%s/tmp.%lu.%u", cache->dir, pid, counter++);
+    bool ok = src_path ? bcc_copy_file_quiet(src_path, temp_path) : bcc_write_entire_file(temp_path, data, size);
+    if (ok) ok = bcc_rename_quiet(temp_path, path);
+    if (!ok) remove(temp_path);
+    return ok;
+}
 
-    switch (statbuf.st_mode & S_IFMT) {
-        case S_IFDIR:  return BCC_FILE_DIRECTORY;
-        case S_IFREG:  return BCC_FILE_REGULAR;
-        case S_IFLNK:  return BCC_FILE_SYMLINK;
-        default:       return BCC_FILE_OTHER;
+// Mark a file of the cache as recently used by bumping its access time
+static void bcc_cache_touch(const char *path)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle != INVALID_HANDLE_VALUE) {
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        SetFileTime(handle, NULL, &now, NULL);
+        CloseHandle(handle);
     }
+#else
+    struct timespec times[2] = {
+        { .tv_sec = 0, .tv_nsec = UTIME_NOW },  // atime
+        { .tv_sec = 0, .tv_nsec = UTIME_OMIT }, // mtime
+    };
+    utimensat(AT_FDCWD, path, times, 0);
 #endif // _WIN32
 }
 
-bool bcc_copy_directory_recursively(const char *src_path, const char *dst_path)
+typedef struct {
+    const char *path;
+    uint64_t atime;
+    uint64_t size;
+} BCC_Cache_File;
+
+typedef struct {
+    BCC_Cache_File *items;
+    size_t count;
+    size_t capacity;
+} BCC_Cache_Files;
+
+static int bcc_cache_file_compare_atime(const void *a, const void *b)
 {
-    bool result = true;
+    uint64_t x = ((const BCC_Cache_File*) a)->atime;
+    uint64_t y = ((const BCC_Cache_File*) b)->atime;
+    return (x > y) - (x < y);
+}
+
+// Collect every file of the cache. Has to be called with the cache locked.
+static bool bcc_cache_scan(const BCC_Cache *cache, BCC_Cache_Files *files)
+{
+    BCC_File_Paths dirs = {0};
     BCC_File_Paths children = {0};
-    BCC_String_Builder src_sb = {0};
-    BCC_String_Builder dst_sb = {0};
+    bool result = true;
+    if (!bcc_read_entire_dir(cache->dir, &dirs)) bcc_return_defer(false);
+    for (size_t i = 0; i < dirs.count; ++i) {
+        const char *name = dirs.items[i];
+        // Only the directories of objects and manifests, the lock and size files stay
+        if (strcmp(name, "manifests") != 0 && !(strlen(name) == 2 && isxdigit(name[0]) && isxdigit(name[1]))) continue;
+
+        const char *dir = bcc_temp_sprintf("%s/%s", cache->dir, name);
+        children.count = 0;
+        if (!bcc_read_entire_dir(dir, &children)) bcc_return_defer(false);
+        for (size_t j = 0; j < children.count; ++j) {
+            if (children.items[j][0] == '.') continue;
+            BCC_Cache_File file = {0};
+            file.path = bcc_temp_sprintf("%s/%s", dir, children.items[j]);
+#ifdef _WIN32
+            WIN32_FILE_ATTRIBUTE_DATA data;
+            if (!GetFileAttributesExA(file.path, GetFileExInfoStandard, &data)) continue;
+            file.atime = ((uint64_t) data.ftLastAccessTime.dwHighDateTime << 32) | data.ftLastAccessTime.dwLowDateTime;
+            file.size = ((uint64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+            struct stat statbuf;
+            if (stat(file.path, &statbuf) < 0) continue;
+#   if defined(__APPLE__)
+            file.atime = (uint64_t) statbuf.st_atimespec.tv_sec*1000000000 + statbuf.st_atimespec.tv_nsec;
+#   else
+            file.atime = (uint64_t) statbuf.st_atim.tv_sec*1000000000 + statbuf.st_atim.tv_nsec;
+#   endif
+            file.size = statbuf.st_size;
+#endif // _WIN32
+            bcc_da_append(files, file);
+        }
+    }
+
+defer:
+    bcc_da_free(dirs);
+    bcc_da_free(children);
+    return result;
+}
+
+static bool bcc_cache_write_size(const BCC_Cache *cache, uint64_t size)
+{
+    const char *text = bcc_temp_sprintf("%llu\n", (unsigned long long) size);
+    return bcc_cache_write_atomic(cache, bcc_temp_sprintf("%s/size", cache->dir), NULL, text, strlen(text));
+}
+
+// Has to be called with the cache locked
+static bool bcc_cache_cleanup_locked(BCC_Cache *cache, uint64_t target_size)
+{
     size_t temp_checkpoint = bcc_temp_save();
+    BCC_Cache_Files files = {0};
+    bool result = bcc_cache_scan(cache, &files);
+    if (result) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < files.count; ++i) total += files.items[i].size;
+        qsort(files.items, files.count, sizeof(*files.items), bcc_cache_file_compare_atime);
+        for (size_t i = 0; i < files.count && total > target_size; ++i) {
+            if (remove(files.items[i].path) < 0) continue;
+            total -= files.items[i].size;
+            cache->evictions += 1;
+        }
+        result = bcc_cache_write_size(cache, total);
+    }
+    bcc_da_free(files);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
 
-    BCC_File_Type type = bcc_get_file_type(src_path);
-    if (type < 0) return false;
+bool bcc_cache_cleanup(BCC_Cache *cache, uint64_t target_size)
+{
+    BCC_Cache_Lock lock = bcc_cache_lock(cache);
+    if (lock == BCC_CACHE_INVALID_LOCK) return false;
+    bool result = bcc_cache_cleanup_locked(cache, target_size);
+    bcc_cache_unlock(lock);
+    return result;
+}
 
-    switch (type) {
-        case BCC_FILE_DIRECTORY: {
-            if (!bcc_mkdir_if_not_exists(dst_path)) bcc_return_defer(false);
-            if (!bcc_read_entire_dir(src_path, &children)) bcc_return_defer(false);
+// Account for the new files of the cache and evict the old ones if it got too big
+static bool bcc_cache_grow(BCC_Cache *cache, uint64_t added)
+{
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_String_Builder content = {0};
+    bool result = true;
 
-            for (size_t i = 0; i < children.count; ++i) {
-                if (strcmp(children.items[i], ".") == 0) continue;
-                if (strcmp(children.items[i], "..") == 0) continue;
+    BCC_Cache_Lock lock = bcc_cache_lock(cache);
+    if (lock == BCC_CACHE_INVALID_LOCK) bcc_return_defer(false);
 
-                src_sb.count = 0;
-                bcc_sb_append_cstr(&src_sb, src_path);
-                bcc_sb_append_cstr(&src_sb, "/");
-                bcc_sb_append_cstr(&src_sb, children.items[i]);
-                bcc_sb_append_null(&src_sb);
+    const char *size_path = bcc_temp_sprintf("%s/size", cache->dir);
+    uint64_t size = 0;
+    if (bcc_file_exists(size_path) > 0 && bcc_read_entire_file(size_path, &content)) {
+        bcc_sb_append_null(&content);
+        size = strtoull(content.items, NULL, 10);
+    }
+    size += added;
 
-                dst_sb.count = 0;
-                bcc_sb_append_cstr(&dst_sb, dst_path);
-                bcc_sb_append_cstr(&dst_sb, "/");
-                bcc_sb_append_cstr(&dst_sb, children.items[i]);
-                bcc_sb_append_null(&dst_sb);
+    if (size > cache->max_size) {
+        result = bcc_cache_cleanup_locked(cache, cache->max_size/10*9);
+    } else {
+        result = bcc_cache_write_size(cache, size);
+    }
 
-                if (!bcc_copy_directory_recursively(src_sb.items, dst_sb.items)) {
-                    bcc_return_defer(false);
-                }
-            }
-        } break;
+    bcc_cache_unlock(lock);
 
-        case BCC_FILE_REGULAR: {
-            if (!bcc_copy_file(src_path, dst_path)) {
-                bcc_return_defer(false);
+defer:
+    bcc_sb_free(content);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
+}
+
+static bool bcc_mkdir_quiet(const char *path)
+{
+#ifdef _WIN32
+    int result = mkdir(path);
+#else
+    int result = mkdir(path, 0755);
+#endif
+    if (result < 0 && errno != EEXIST) {
+        bcc_log(BCC_ERROR, "could not create directory `%s`: %s", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+uint64_t bcc_trace_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart)*1000000 +
+           (uint64_t) (counter.QuadPart % frequency.QuadPart)*1000000/frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec*1000000 + now.tv_nsec/1000;
+#endif // _WIN32
+}
+
+void bcc_sb_append_json_string(BCC_String_Builder *sb, const char *cstr)
+{
+    bcc_da_append(sb, '"');
+    for (const char *p = cstr; *p; ++p) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\') {
+            bcc_da_append(sb, '\\');
+            bcc_da_append(sb, c);
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            bcc_sb_append_cstr(sb, escape);
+        } else {
+            bcc_da_append(sb, c);
+        }
+    }
+    bcc_da_append(sb, '"');
+}
+
+// A command that has been started but not waited on yet
+typedef struct {
+    BCC_Proc proc;
+    uint64_t start;
+    size_t tid;
+    char *name;
+    char *cmd;
+} BCC_Trace_Proc;
+
+static struct {
+    FILE *file;
+    bool failed;
+    size_t named_tids; // Tracks 0..named_tids-1 already have their names
+    BCC_Trace_Proc *items;
+    size_t count;
+    size_t capacity;
+} bcc_trace = {0};
+
+static unsigned long bcc_trace_pid(void)
+{
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif // _WIN32
+}
+
+// Write a single event. Every event goes out in one write so the processes that share the
+// file can not interleave their events.
+static void bcc_trace_write(BCC_String_Builder *event)
+{
+    if (bcc_trace.file == NULL && !bcc_trace.failed) {
+        const char *path = getenv("BCC_TRACE_FILE");
+        if (path != NULL && *path != '\0') {
+            bcc_trace.file = fopen(path, "ab");
+        } else {
+            path = BCC_TRACE_PATH;
+            const char *slash = strrchr(path, '/');
+            if (slash != NULL) bcc_mkdir_quiet(bcc_temp_sprintf("%.*s", (int) (slash - path), path));
+            bcc_trace.file = fopen(path, "wb");
+            if (bcc_trace.file != NULL) {
+                fputs("[\n", bcc_trace.file);
+#ifdef _WIN32
+                _putenv_s("BCC_TRACE_FILE", path);
+#else
+                setenv("BCC_TRACE_FILE", path, 1);
+#endif // _WIN32
             }
-        } break;
+        }
+        if (bcc_trace.file == NULL) {
+            bcc_log(BCC_WARNING, "could not open the trace file %s: %s", path, strerror(errno));
+            bcc_trace.failed = true;
+            return;
+        }
+    }
+    if (bcc_trace.file == NULL) return;
 
-        case BCC_FILE_SYMLINK: {
-            bcc_log(BCC_WARNING, "TODO: Copying symlinks is not supported yet");
-        } break;
+    fwrite(event->items, 1, event->count, bcc_trace.file);
+    fflush(bcc_trace.file);
+}
 
-        case BCC_FILE_OTHER: {
-            bcc_log(BCC_ERROR, "Unsupported type of file %s", src_path);
-            bcc_return_defer(false);
-        } break;
+static void bcc_trace_name_tids(size_t tid)
+{
+    BCC_String_Builder event = {0};
+    for (; bcc_trace.named_tids <= tid; ++bcc_trace.named_tids) {
+        const char *name = bcc_trace.named_tids == 0 ? "bcc" : bcc_temp_sprintf("job %zu", bcc_trace.named_tids);
+        event.count = 0;
+        bcc_sb_append_cstr(&event, bcc_temp_sprintf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%zu,\"args\":{\"name\":\"%s\"}},\n",
+                                                    bcc_trace_pid(), bcc_trace.named_tids, name));
+        bcc_trace_write(&event);
+    }
+    bcc_sb_free(event);
+}
 
-        default: BCC_ASSERT(0 && "unreachable");
+static void bcc_trace_phase(const char *name, char ph)
+{
+    size_t temp_checkpoint = bcc_temp_save();
+    bcc_trace_name_tids(0);
+    BCC_String_Builder event = {0};
+    bcc_sb_append_cstr(&event, "{\"name\":");
+    bcc_sb_append_json_string(&event, name);
+    bcc_sb_append_cstr(&event, bcc_temp_sprintf(",\"cat\":\"bcc\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%lu,\"tid\":0},\n",
+                                                ph, (unsigned long long) bcc_trace_now(), bcc_trace_pid()));
+    bcc_trace_write(&event);
+    bcc_sb_free(event);
+    bcc_temp_rewind(temp_checkpoint);
+}
+
+void bcc_trace_begin(const char *name)
+{
+    bcc_trace_phase(name, 'B');
+}
+
+void bcc_trace_end(void)
+{
+    bcc_trace_phase("", 'E');
+}
+
+void bcc_trace_proc_start(BCC_Proc proc, BCC_Cmd cmd)
+{
+    BCC_Trace_Proc trace_proc = {0};
+    trace_proc.proc = proc;
+    trace_proc.start = bcc_trace_now();
+
+    // NOTE: the slice is named after the output of the command, the whole command line is
+    // in the arguments of the event
+    const char *name = cmd.items[0];
+    for (size_t i = 0; i + 1 < cmd.count; ++i) {
+        if (strcmp(cmd.items[i], "-o") == 0) name = cmd.items[i + 1];
     }
+    trace_proc.name = strdup(name);
 
-defer:
+    BCC_String_Builder render = {0};
+    bcc_cmd_render(cmd, &render);
+    bcc_sb_append_null(&render);
+    trace_proc.cmd = render.items;
+    bcc_da_append(&bcc_trace, trace_proc);
+}
+
+void bcc_trace_proc_slot(BCC_Proc proc, size_t slot)
+{
+    for (size_t i = 0; i < bcc_trace.count; ++i) {
+        if (bcc_trace.items[i].proc == proc) bcc_trace.items[i].tid = slot + 1;
+    }
+}
+
+void bcc_trace_proc_end(BCC_Proc proc, int exit_code, BCC_Proc_Usage *usage)
+{
+    for (size_t i = 0; i < bcc_trace.count; ++i) {
+        BCC_Trace_Proc *trace_proc = &bcc_trace.items[i];
+        if (trace_proc->proc != proc) continue;
+
+        size_t temp_checkpoint = bcc_temp_save();
+        uint64_t end = bcc_trace_now();
+        usage->wall_us = end - trace_proc->start;
+        bcc_trace_name_tids(trace_proc->tid);
+        BCC_String_Builder event = {0};
+        bcc_sb_append_cstr(&event, "{\"name\":");
+        bcc_sb_append_json_string(&event, trace_proc->name);
+        bcc_sb_append_cstr(&event, bcc_temp_sprintf(",\"cat\":\"cmd\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%lu,\"tid\":%zu,\"args\":{",
+                                                    (unsigned long long) trace_proc->start, (unsigned long long) (end - trace_proc->start),
+                                                    bcc_trace_pid(), trace_proc->tid));
+#ifdef _WIN32
+        bcc_sb_append_cstr(&event, bcc_temp_sprintf("\"pid\":%lu,", GetProcessId(proc)));
+#else
+        bcc_sb_append_cstr(&event, bcc_temp_sprintf("\"pid\":%d,", (int) proc));
+#endif // _WIN32
+        bcc_sb_append_cstr(&event, bcc_temp_sprintf("\"exit_code\":%d,\"user_us\":%llu,\"sys_us\":%llu,\"max_rss_kb\":%llu,\"cmd\":",
+                                                    exit_code, (unsigned long long) usage->user_us, (unsigned long long) usage->sys_us,
+                                                    (unsigned long long) usage->max_rss_kb));
+        bcc_sb_append_json_string(&event, trace_proc->cmd);
+        bcc_sb_append_cstr(&event, "}},\n");
+        bcc_trace_write(&event);
+        bcc_sb_free(event);
+        bcc_temp_rewind(temp_checkpoint);
+
+        free(trace_proc->name);
+        free(trace_proc->cmd);
+        *trace_proc = bcc_trace.items[--bcc_trace.count];
+        return;
+    }
+}
+
+bool bcc_cache_init(BCC_Cache *cache, const char *dir)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->dir = dir;
+    cache->max_size = bcc_cache_max_size();
+
+    // mkdir -p
+    size_t temp_checkpoint = bcc_temp_save();
+    char *path = bcc_temp_strdup(dir);
+    bool result = true;
+    for (char *p = path + 1; *p && result; ++p) {
+        if (*p != '/' && *p != '\\') continue;
+        char c = *p;
+        *p = '\0';
+        result = bcc_mkdir_quiet(path);
+        *p = c;
+    }
+    if (result) result = bcc_mkdir_quiet(path);
+    if (result) result = bcc_mkdir_quiet(bcc_temp_sprintf("%s/manifests", dir));
     bcc_temp_rewind(temp_checkpoint);
-    bcc_da_free(src_sb);
-    bcc_da_free(dst_sb);
-    bcc_da_free(children);
     return result;
 }
 
-char *bcc_temp_strdup(const char *cstr)
+// Step 1 of the lookup, see BCC_Cache
+bool bcc_cache_manifest_key(const BCC_Rule *rule, uint64_t *key)
 {
-    size_t n = strlen(cstr);
-    char *result = bcc_temp_alloc(n + 1);
-    BCC_ASSERT(result != NULL && "Increase BCC_TEMP_CAPACITY");
-    memcpy(result, cstr, n);
-    result[n] = '\0';
-    return result;
+    uint64_t hash = bcc_hash_cstr(BCC_HASH_INIT, "bcc cache v1");
+    uint64_t identity = bcc_compiler_identity(rule->cmd.items[0]);
+    hash = bcc_hash_update(hash, &identity, sizeof(identity));
+
+    // NOTE: the output and the depfile paths are left out, so the same compile in a
+    // different place still hits. Debug info contains the working directory though.
+    for (size_t i = 1; i < rule->cmd.count; ++i) {
+        const char *arg = rule->cmd.items[i];
+        hash = bcc_hash_cstr(hash, arg);
+        if (strcmp(arg, "-o") == 0 || strcmp(arg, "-MF") == 0) i += 1;
+    }
+
+    char cwd[4096];
+#ifdef _WIN32
+    if (_getcwd(cwd, sizeof(cwd)) == NULL) return false;
+#else
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return false;
+#endif // _WIN32
+    hash = bcc_hash_cstr(hash, cwd);
+
+    for (size_t i = 0; i < rule->inputs.count; ++i) {
+        uint64_t content = 0;
+        if (!bcc_file_hash(rule->inputs.items[i], &content)) return false;
+        hash = bcc_hash_cstr(hash, rule->inputs.items[i]);
+        hash = bcc_hash_update(hash, &content, sizeof(content));
+    }
+
+    *key = hash;
+    return true;
 }
 
-void *bcc_temp_alloc(size_t size)
+// Step 2 of the lookup, see BCC_Cache
+static bool bcc_cache_object_key(uint64_t manifest_key, const char **deps, size_t deps_count, uint64_t *key)
 {
-    if (bcc_temp_size + size > BCC_TEMP_CAPACITY) return NULL;
-    void *result = &bcc_temp[bcc_temp_size];
-    bcc_temp_size += size;
+    uint64_t hash = bcc_hash_update(BCC_HASH_INIT, &manifest_key, sizeof(manifest_key));
+    for (size_t i = 0; i < deps_count; ++i) {
+        uint64_t content = 0;
+        if (!bcc_file_hash(deps[i], &content)) return false;
+        hash = bcc_hash_cstr(hash, deps[i]);
+        hash = bcc_hash_update(hash, &content, sizeof(content));
+    }
+    *key = hash;
+    return true;
+}
+
+static const char *bcc_cache_manifest_path(const BCC_Cache *cache, uint64_t key)
+{
+    return bcc_temp_sprintf("%s/manifests/%016llx", cache->dir, (unsigned long long) key);
+}
+
+// Path of a cached file without the extension
+static const char *bcc_cache_object_path(const BCC_Cache *cache, uint64_t key)
+{
+    return bcc_temp_sprintf("%s/%02x/%016llx", cache->dir, (unsigned) (key >> 56), (unsigned long long) key);
+}
+
+// A manifest is the list of headers of the entry, one per line
+static void bcc_cache_parse_manifest(BCC_String_View sv, BCC_File_Paths *deps)
+{
+    while (sv.count > 0) {
+        BCC_String_View dep = bcc_sv_chop_by_delim(&sv, '\n');
+        if (dep.count > 0) bcc_da_append(deps, bcc_temp_sv_to_cstr(dep));
+    }
+}
+
+bool bcc_cache_fetch(BCC_Cache *cache, const BCC_Rule *rule)
+{
+    BCC_ASSERT(rule->cacheable && rule->outputs.count > 0 && rule->cmd.count > 0);
+    bool result = false;
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_String_Builder manifest = {0};
+    BCC_File_Paths deps = {0};
+    const char *output_path = rule->outputs.items[0];
+
+    uint64_t manifest_key = 0;
+    if (!bcc_cache_manifest_key(rule, &manifest_key)) bcc_return_defer(false);
+
+    const char *manifest_path = bcc_cache_manifest_path(cache, manifest_key);
+    if (bcc_file_exists(manifest_path) <= 0) bcc_return_defer(false);
+    if (!bcc_read_entire_file(manifest_path, &manifest)) bcc_return_defer(false);
+    bcc_cache_parse_manifest(bcc_sv_from_parts(manifest.items, manifest.count), &deps);
+
+    uint64_t object_key = 0;
+    if (!bcc_cache_object_key(manifest_key, deps.items, deps.count, &object_key)) bcc_return_defer(false);
+
+    const char *object_path = bcc_cache_object_path(cache, object_key);
+    const char *cached_output = bcc_temp_sprintf("%s.o", object_path);
+    const char *cached_depfile = bcc_temp_sprintf("%s.d", object_path);
+    if (bcc_file_exists(cached_output) <= 0) bcc_return_defer(false);
+    if (rule->depfile && bcc_file_exists(cached_depfile) <= 0) bcc_return_defer(false);
+
+    remove(output_path);
+#ifdef _WIN32
+    bool linked = CreateHardLinkA(output_path, cached_output, NULL);
+#else
+    bool linked = link(cached_output, output_path) == 0;
+#endif // _WIN32
+    if (!linked && !bcc_copy_file_quiet(cached_output, output_path)) bcc_return_defer(false);
+    // NOTE: the restored output must look newer than its inputs
+    bcc_touch(output_path);
+    if (rule->depfile && !bcc_copy_file_quiet(cached_depfile, rule->depfile)) bcc_return_defer(false);
+
+    bcc_cache_touch(manifest_path);
+    bcc_cache_touch(cached_output);
+    if (rule->depfile) bcc_cache_touch(cached_depfile);
+    bcc_log(BCC_INFO, "CACHE: %s", output_path);
+    result = true;
+
+defer:
+    if (result) cache->hits += 1; else cache->misses += 1;
+    bcc_sb_free(manifest);
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
     return result;
 }
 
-char *bcc_temp_sprintf(const char *format, ...)
+bool bcc_cache_store(BCC_Cache *cache, const BCC_Rule *rule)
 {
-    va_list args;
-    va_start(args, format);
-    int n = vsnprintf(NULL, 0, format, args);
-    va_end(args);
-    BCC_ASSERT(n >= 0);
-    char *result = bcc_temp_alloc(n + 1);
-    BCC_ASSERT(result != NULL && "Extend the size of the temporary allocator");
-    // TODO: use proper arenas for the temporary allocator;
-    va_start(args, format);
-    vsnprintf(result, n + 1, format, args);
-    va_end(args);
+    BCC_ASSERT(rule->cacheable && rule->outputs.count > 0 && rule->cmd.count > 0);
+    bool result = true;
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_String_Builder manifest = {0};
+    BCC_File_Paths deps = {0};
+    const char *output_path = rule->outputs.items[0];
+
+    // NOTE: without a depfile there is no way to tell which headers the object depends on,
+    // so only the explicit inputs are taken into account
+    if (rule->depfile && !bcc_parse_depfile(rule->depfile, &deps)) bcc_return_defer(false);
+
+    uint64_t manifest_key = 0;
+    uint64_t object_key = 0;
+    if (!bcc_cache_manifest_key(rule, &manifest_key)) bcc_return_defer(false);
+    if (!bcc_cache_object_key(manifest_key, deps.items, deps.count, &object_key)) bcc_return_defer(false);
+
+    for (size_t i = 0; i < deps.count; ++i) {
+        bcc_sb_append_cstr(&manifest, deps.items[i]);
+        bcc_sb_append_cstr(&manifest, "\n");
+    }
+
+    const char *object_path = bcc_cache_object_path(cache, object_key);
+    const char *cached_output = bcc_temp_sprintf("%s.o", object_path);
+    const char *cached_depfile = bcc_temp_sprintf("%s.d", object_path);
+    if (!bcc_mkdir_quiet(bcc_temp_sprintf("%s/%02x", cache->dir, (unsigned) (object_key >> 56)))) bcc_return_defer(false);
+    // NOTE: the object goes last, a reader only trusts an entry once its object is there
+    if (rule->depfile && !bcc_cache_write_atomic(cache, cached_depfile, rule->depfile, NULL, 0)) bcc_return_defer(false);
+    if (!bcc_cache_write_atomic(cache, cached_output, output_path, NULL, 0)) bcc_return_defer(false);
+    if (!bcc_cache_write_atomic(cache, bcc_cache_manifest_path(cache, manifest_key), NULL, manifest.items, manifest.count)) bcc_return_defer(false);
+    cache->stores += 1;
+
+    uint64_t added = manifest.count;
+    for (size_t i = 0; i < 2; ++i) {
+        const char *path = i == 0 ? cached_output : cached_depfile;
+        if (i == 1 && !rule->depfile) break;
+        FILE *f = fopen(path, "rb");
+        if (f == NULL) continue;
+        if (fseek(f, 0, SEEK_END) == 0) {
+            long size = ftell(f);
+            if (size > 0) added += size;
+        }
+        fclose(f);
+    }
+    if (!bcc_cache_grow(cache, added)) bcc_return_defer(false);
 
+defer:
+    if (!result) bcc_log(BCC_WARNING, "could not put %s into the cache", output_path);
+    bcc_sb_free(manifest);
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
     return result;
 }
 
-void bcc_temp_reset(void)
+void bcc_cache_report(const BCC_Cache *cache)
+{
+    size_t lookups = cache->hits + cache->misses;
+    if (lookups == 0) return;
+    bcc_log(BCC_INFO, "cache: %zu hits (%zu remote), %zu misses (%.0f%% hit rate), %zu stored, %zu uploaded, %zu evicted in %s",
+            cache->hits, cache->remote_hits, cache->misses, 100.0*cache->hits/lookups, cache->stores, cache->uploads, cache->evictions, cache->dir);
+}
+
+const char *bcc_remote_cache_url(void)
+{
+    if (bcc_options.no_cache) return NULL;
+    const char *url = bcc_options.remote_cache;
+    if (url == NULL) url = getenv("BCC_REMOTE_CACHE");
+    if (url == NULL || *url == '\0') return NULL;
+    return url;
+}
+
+#ifdef _WIN32
+typedef SOCKET BCC_Socket;
+#define BCC_INVALID_SOCKET INVALID_SOCKET
+#else
+typedef int BCC_Socket;
+#define BCC_INVALID_SOCKET (-1)
+#endif // _WIN32
+
+static bool bcc_net_init(void)
+{
+#ifdef _WIN32
+    static bool initialized = false;
+    if (initialized) return true;
+    WSADATA wsa_data;
+    int error = WSAStartup(MAKEWORD(2, 2), &wsa_data);
+    if (error != 0) {
+        bcc_log(BCC_ERROR, "could not initialize Winsock: %d", error);
+        return false;
+    }
+    initialized = true;
+#else
+    // NOTE: a peer that goes away in the middle of a transfer is an error, not a reason to die
+    signal(SIGPIPE, SIG_IGN);
+#endif // _WIN32
+    return true;
+}
+
+static const char *bcc_net_error(void)
 {
-    bcc_temp_size = 0;
+#ifdef _WIN32
+    return bcc_temp_sprintf("error %d", WSAGetLastError());
+#else
+    return strerror(errno);
+#endif // _WIN32
 }
 
-size_t bcc_temp_save(void)
+static void bcc_socket_close(BCC_Socket sock)
 {
-    return bcc_temp_size;
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif // _WIN32
 }
 
-void bcc_temp_rewind(size_t checkpoint)
+static void bcc_socket_set_timeout(BCC_Socket sock, int seconds)
 {
-    bcc_temp_size = checkpoint;
+#ifdef _WIN32
+    DWORD timeout = seconds*1000;
+#else
+    struct timeval timeout = { .tv_sec = seconds, .tv_usec = 0 };
+#endif // _WIN32
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*) &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char*) &timeout, sizeof(timeout));
 }
 
-const char *bcc_temp_sv_to_cstr(BCC_String_View sv)
+static bool bcc_socket_send(BCC_Socket sock, const char *data, size_t size)
 {
-    char *result = bcc_temp_alloc(sv.count + 1);
-    BCC_ASSERT(result != NULL && "Extend the size of the temporary allocator");
-    memcpy(result, sv.data, sv.count);
-    result[sv.count] = '\0';
-    return result;
+    while (size > 0) {
+        int chunk = size > (1 << 20) ? (1 << 20) : (int) size;
+        int n = send(sock, data, chunk, 0);
+        if (n < 0) {
+#ifndef _WIN32
+            if (errno == EINTR) continue;
+#endif // _WIN32
+            bcc_log(BCC_ERROR, "could not send to the socket: %s", bcc_net_error());
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
 }
 
-int bcc_needs_rebuild(const char *output_path, const char **input_paths, size_t input_paths_count)
-{
-#ifdef _WIN32
-    BOOL bSuccess;
+// Receiving side of an HTTP connection
+typedef struct {
+    BCC_Socket sock;
+    BCC_String_Builder buffer;
+    size_t start; // Everything before start has already been consumed
+} BCC_Http_Conn;
 
-    HANDLE output_path_fd = CreateFile(output_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, NULL);
-    if (output_path_fd == INVALID_HANDLE_VALUE) {
-        // NOTE: if output does not exist it 100% must be rebuilt
-        if (GetLastError() == ERROR_FILE_NOT_FOUND) return 1;
-        bcc_log(BCC_ERROR, "Could not open file %s: %lu", output_path, GetLastError());
-        return -1;
-    }
-    FILETIME output_path_time;
-    bSuccess = GetFileTime(output_path_fd, NULL, NULL, &output_path_time);
-    CloseHandle(output_path_fd);
-    if (!bSuccess) {
-        bcc_log(BCC_ERROR, "Could not get time of %s: %lu", output_path, GetLastError());
-        return -1;
+// RETURNS:
+//  1 - more data has been received
+//  0 - the peer has closed the connection
+// -1 - error. The error is logged
+static int bcc_http_fill(BCC_Http_Conn *conn)
+{
+    if (conn->start > 0) {
+        memmove(conn->buffer.items, conn->buffer.items + conn->start, conn->buffer.count - conn->start);
+        conn->buffer.count -= conn->start;
+        conn->start = 0;
     }
 
-    for (size_t i = 0; i < input_paths_count; ++i) {
-        const char *input_path = input_paths[i];
-        HANDLE input_path_fd = CreateFile(input_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, NULL);
-        if (input_path_fd == INVALID_HANDLE_VALUE) {
-            // NOTE: non-existing input is an error cause it is needed for building in the first place
-            bcc_log(BCC_ERROR, "Could not open file %s: %lu", input_path, GetLastError());
-            return -1;
-        }
-        FILETIME input_path_time;
-        bSuccess = GetFileTime(input_path_fd, NULL, NULL, &input_path_time);
-        CloseHandle(input_path_fd);
-        if (!bSuccess) {
-            bcc_log(BCC_ERROR, "Could not get time of %s: %lu", input_path, GetLastError());
+    char chunk[64*1024];
+    for (;;) {
+        int n = recv(conn->sock, chunk, sizeof(chunk), 0);
+        if (n < 0) {
+#ifndef _WIN32
+            if (errno == EINTR) continue;
+#endif // _WIN32
+            bcc_log(BCC_ERROR, "could not receive from the socket: %s", bcc_net_error());
             return -1;
         }
-
-        // NOTE: if even a single input_path is fresher than output_path that's 100% rebuild
-        if (CompareFileTime(&input_path_time, &output_path_time) == 1) return 1;
+        if (n == 0) return 0;
+        bcc_da_append_many(&conn->buffer, chunk, n);
+        return 1;
     }
+}
 
-    return 0;
-#else
-    struct stat statbuf = {0};
+// Read the request or status line together with the headers. The view is valid until the
+// next read from the connection.
+//
+// RETURNS:
+//  1 - the head has been read
+//  0 - the peer has closed the connection in between two messages
+// -1 - error. The error is logged
+static int bcc_http_read_head(BCC_Http_Conn *conn, BCC_String_View *head)
+{
+    size_t checked = conn->start;
+    for (;;) {
+        for (size_t i = checked; i + 4 <= conn->buffer.count; ++i) {
+            if (memcmp(conn->buffer.items + i, "\r\n\r\n", 4) == 0) {
+                *head = bcc_sv_from_parts(conn->buffer.items + conn->start, i - conn->start);
+                conn->start = i + 4;
+                return 1;
+            }
+        }
+        if (conn->buffer.count - conn->start > 64*1024) {
+            bcc_log(BCC_ERROR, "HTTP headers are too large");
+            return -1;
+        }
 
-    if (stat(output_path, &statbuf) < 0) {
-        // NOTE: if output does not exist it 100% must be rebuilt
-        if (errno == ENOENT) return 1;
-        bcc_log(BCC_ERROR, "could not stat %s: %s", output_path, strerror(errno));
-        return -1;
+        size_t pending = conn->buffer.count - conn->start;
+        checked = pending >= 3 ? pending - 3 : 0;
+        int n = bcc_http_fill(conn);
+        if (n < 0) return -1;
+        if (n == 0) {
+            if (conn->buffer.count == conn->start) return 0;
+            bcc_log(BCC_ERROR, "connection closed in the middle of HTTP headers");
+            return -1;
+        }
     }
-    int output_path_time = statbuf.st_mtime;
+}
 
-    for (size_t i = 0; i < input_paths_count; ++i) {
-        const char *input_path = input_paths[i];
-        if (stat(input_path, &statbuf) < 0) {
-            // NOTE: non-existing input is an error cause it is needed for building in the first place
-            bcc_log(BCC_ERROR, "could not stat %s: %s", input_path, strerror(errno));
-            return -1;
+// Read size bytes of body into body. A NULL body discards them
+static bool bcc_http_read_body(BCC_Http_Conn *conn, size_t size, BCC_String_Builder *body)
+{
+    while (conn->buffer.count - conn->start < size) {
+        int n = bcc_http_fill(conn);
+        if (n < 0) return false;
+        if (n == 0) {
+            bcc_log(BCC_ERROR, "connection closed in the middle of an HTTP body");
+            return false;
         }
-        int input_path_time = statbuf.st_mtime;
-        // NOTE: if even a single input_path is fresher than output_path that's 100% rebuild
-        if (input_path_time > output_path_time) return 1;
     }
+    if (body) bcc_da_append_many(body, conn->buffer.items + conn->start, size);
+    conn->start += size;
+    return true;
+}
 
-    return 0;
-#endif
+static bool bcc_sv_eq_ignorecase(BCC_String_View a, const char *b)
+{
+    size_t n = strlen(b);
+    if (a.count != n) return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (tolower((unsigned char) a.data[i]) != tolower((unsigned char) b[i])) return false;
+    }
+    return true;
 }
 
-int bcc_needs_rebuild1(const char *output_path, const char *input_path)
+// Only Content-Length framing is supported, chunked bodies are rejected. A length that does not
+// fit into size_t comes out as SIZE_MAX, the callers reject it with BCC_REMOTE_CACHE_MAX_BODY.
+static bool bcc_http_content_length(BCC_String_View head, size_t *length)
 {
-    return bcc_needs_rebuild(output_path, &input_path, 1);
+    *length = 0;
+    bcc_sv_chop_by_delim(&head, '\n'); // request or status line
+    while (head.count > 0) {
+        BCC_String_View value = bcc_sv_chop_by_delim(&head, '\n');
+        BCC_String_View name = bcc_sv_trim(bcc_sv_chop_by_delim(&value, ':'));
+        value = bcc_sv_trim(value);
+        if (bcc_sv_eq_ignorecase(name, "Content-Length")) {
+            if (value.count == 0) return false;
+            size_t n = 0;
+            for (size_t i = 0; i < value.count; ++i) {
+                if (!isdigit((unsigned char) value.data[i])) return false;
+                size_t digit = value.data[i] - '0';
+                n = n > (SIZE_MAX - digit)/10 ? SIZE_MAX : n*10 + digit;
+            }
+            *length = n;
+        } else if (bcc_sv_eq_ignorecase(name, "Transfer-Encoding")) {
+            bcc_log(BCC_ERROR, "unsupported HTTP transfer encoding `"SV_Fmt"`", SV_Arg(value));
+            return false;
+        }
+    }
+    return true;
 }
 
-bool bcc_rename(const char *old_path, const char *new_path)
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *prefix; // Path of the cache on the server, without the trailing slash
+} BCC_Url;
+
+static bool bcc_url_parse(const char *url, BCC_Url *parsed)
 {
-    bcc_log(BCC_INFO, "renaming %s -> %s", old_path, new_path);
-#ifdef _WIN32
-    if (!MoveFileEx(old_path, new_path, MOVEFILE_REPLACE_EXISTING)) {
-        bcc_log(BCC_ERROR, "could not rename %s to %s: %lu", old_path, new_path, GetLastError());
+    if (strncmp(url, "http://", 7) != 0) {
+        bcc_log(BCC_ERROR, "only http:// URLs are supported by the remote cache: %s", url);
         return false;
     }
-#else
-    if (rename(old_path, new_path) < 0) {
-        bcc_log(BCC_ERROR, "could not rename %s to %s: %s", old_path, new_path, strerror(errno));
+    const char *host = url + 7;
+    size_t host_len = strcspn(host, ":/");
+    if (host_len == 0) {
+        bcc_log(BCC_ERROR, "no host in URL %s", url);
         return false;
     }
-#endif // _WIN32
+    parsed->host = bcc_temp_sv_to_cstr(bcc_sv_from_parts(host, host_len));
+
+    const char *rest = host + host_len;
+    parsed->port = "80";
+    if (*rest == ':') {
+        size_t port_len = strcspn(rest + 1, "/");
+        parsed->port = bcc_temp_sv_to_cstr(bcc_sv_from_parts(rest + 1, port_len));
+        rest += 1 + port_len;
+    }
+
+    size_t prefix_len = strlen(rest);
+    while (prefix_len > 0 && rest[prefix_len - 1] == '/') prefix_len -= 1;
+    parsed->prefix = bcc_temp_sv_to_cstr(bcc_sv_from_parts(rest, prefix_len));
     return true;
 }
 
-bool bcc_read_entire_file(const char *path, BCC_String_Builder *sb)
+static BCC_Socket bcc_net_connect(const char *host, const char *port)
 {
-    bool result = true;
-
-    FILE *f = fopen(path, "rb");
-    if (f == NULL)                 bcc_return_defer(false);
-    if (fseek(f, 0, SEEK_END) < 0) bcc_return_defer(false);
-    long m = ftell(f);
-    if (m < 0)                     bcc_return_defer(false);
-    if (fseek(f, 0, SEEK_SET) < 0) bcc_return_defer(false);
-
-    size_t new_count = sb->count + m;
-    if (new_count > sb->capacity) {
-        sb->items = realloc(sb->items, new_count);
-        BCC_ASSERT(sb->items != NULL && "Buy more RAM lool!!");
-        sb->capacity = new_count;
+    struct addrinfo hints = {0};
+    struct addrinfo *addrs = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int error = getaddrinfo(host, port, &hints, &addrs);
+    if (error != 0) {
+        bcc_log(BCC_ERROR, "could not resolve %s: %s", host, gai_strerror(error));
+        return BCC_INVALID_SOCKET;
     }
 
-    fread(sb->items + sb->count, m, 1, f);
-    if (ferror(f)) {
-        // TODO: Afaik, ferror does not set errno. So the error reporting in defer is not correct in this case.
-        bcc_return_defer(false);
+    BCC_Socket sock = BCC_INVALID_SOCKET;
+    for (struct addrinfo *addr = addrs; addr != NULL; addr = addr->ai_next) {
+        sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (sock == BCC_INVALID_SOCKET) continue;
+        bcc_socket_set_timeout(sock, BCC_REMOTE_CACHE_TIMEOUT);
+        if (connect(sock, addr->ai_addr, (int) addr->ai_addrlen) == 0) break;
+        bcc_socket_close(sock);
+        sock = BCC_INVALID_SOCKET;
     }
-    sb->count = new_count;
-
-defer:
-    if (!result) bcc_log(BCC_ERROR, "Could not read file %s: %s", path, strerror(errno));
-    if (f) fclose(f);
-    return result;
+    if (sock == BCC_INVALID_SOCKET) bcc_log(BCC_ERROR, "could not connect to %s:%s: %s", host, port, bcc_net_error());
+    freeaddrinfo(addrs);
+    return sock;
 }
 
-BCC_String_View bcc_sv_chop_by_delim(BCC_String_View *sv, char delim)
+typedef struct {
+    const char *method;      // "GET" or "PUT"
+    const char *path;        // Relative to the prefix of the URL
+    BCC_String_Builder body; // Sent with a PUT, received with a GET
+    int status;
+} BCC_Http_Request;
+
+// Pipeline the requests and read the responses back in the same order
+static bool bcc_http_pipeline(const BCC_Url *url, BCC_Http_Request *requests, size_t count)
 {
-    size_t i = 0;
-    while (i < sv->count && sv->data[i] != delim) {
-        i += 1;
-    }
+    if (count == 0) return true;
+    bool result = true;
+    BCC_String_Builder out = {0};
+    BCC_Http_Conn conn = {0};
+    conn.sock = bcc_net_connect(url->host, url->port);
+    if (conn.sock == BCC_INVALID_SOCKET) return false;
+    size_t *sizes = calloc(count, sizeof(*sizes));
+    BCC_ASSERT(sizes != NULL && "Buy more RAM lol");
+
+    size_t next = 0;      // Next request to send
+    size_t in_flight = 0; // Bytes of the requests that have been sent, but not answered yet
+    for (size_t i = 0; i < count; ++i) {
+        // NOTE: the server does not read the requests while it waits to send a response, and the
+        // responses are not read while a request is being sent. So no more is sent at once than
+        // the socket buffers surely hold, or both sides could wait for each other forever. A
+        // bigger request goes alone, then the server only reads.
+        while (next < count) {
+            BCC_Http_Request *request = &requests[next];
+            size_t temp_checkpoint = bcc_temp_save();
+            bool is_put = strcmp(request->method, "PUT") == 0;
+            const char *head = bcc_temp_sprintf("%s %s/%s HTTP/1.1\r\nHost: %s\r\n", request->method, url->prefix, request->path, url->host);
+            if (is_put) head = bcc_temp_sprintf("%sContent-Length: %zu\r\n", head, request->body.count);
+            sizes[next] = strlen(head) + 2 + (is_put ? request->body.count : 0);
+            if (next > i && in_flight + sizes[next] > BCC_REMOTE_CACHE_IN_FLIGHT) {
+                bcc_temp_rewind(temp_checkpoint);
+                break;
+            }
+            out.count = 0;
+            bcc_sb_append_cstr(&out, head);
+            bcc_sb_append_cstr(&out, "\r\n");
+            if (is_put) bcc_da_append_many(&out, request->body.items, request->body.count);
+            bcc_temp_rewind(temp_checkpoint);
+            if (!bcc_socket_send(conn.sock, out.items, out.count)) bcc_return_defer(false);
+            in_flight += sizes[next];
+            next += 1;
+        }
 
-    BCC_String_View result = bcc_sv_from_parts(sv->data, i);
+        BCC_Http_Request *request = &requests[i];
+        BCC_String_View head;
+        int n = bcc_http_read_head(&conn, &head);
+        if (n == 0) bcc_log(BCC_ERROR, "%s:%s closed the connection", url->host, url->port);
+        if (n <= 0) bcc_return_defer(false);
 
-    if (i < sv->count) {
-        sv->count -= i + 1;
-        sv->data  += i + 1;
-    } else {
-        sv->count -= i;
-        sv->data  += i;
+        // HTTP/1.1 200 OK
+        if (head.count < 12 || strncmp(head.data, "HTTP/1.", 7) != 0 ||
+            !isdigit((unsigned char) head.data[9]) || !isdigit((unsigned char) head.data[10]) || !isdigit((unsigned char) head.data[11])) {
+            bcc_log(BCC_ERROR, "invalid HTTP response from %s:%s", url->host, url->port);
+            bcc_return_defer(false);
+        }
+        request->status = (head.data[9] - '0')*100 + (head.data[10] - '0')*10 + (head.data[11] - '0');
+
+        size_t length = 0;
+        if (!bcc_http_content_length(head, &length)) bcc_return_defer(false);
+        if (length > BCC_REMOTE_CACHE_MAX_BODY) {
+            bcc_log(BCC_ERROR, "HTTP response from %s:%s is too large", url->host, url->port);
+            bcc_return_defer(false);
+        }
+        bool keep_body = strcmp(request->method, "GET") == 0 && request->status == 200;
+        if (keep_body) request->body.count = 0;
+        if (!bcc_http_read_body(&conn, length, keep_body ? &request->body : NULL)) bcc_return_defer(false);
+        in_flight -= sizes[i];
     }
 
+defer:
+    free(sizes);
+    bcc_socket_close(conn.sock);
+    bcc_sb_free(conn.buffer);
+    bcc_sb_free(out);
     return result;
 }
 
-BCC_String_View bcc_sv_from_parts(const char *data, size_t count)
+static void bcc_http_requests_free(BCC_Http_Request *requests, size_t count)
 {
-    BCC_String_View sv;
-    sv.count = count;
-    sv.data = data;
-    return sv;
+    for (size_t i = 0; i < count; ++i) bcc_sb_free(requests[i].body);
+    free(requests);
 }
 
-BCC_String_View bcc_sv_trim_left(BCC_String_View sv)
+bool bcc_remote_cache_pull(BCC_Cache *cache, const char *url, const char **manifest_keys, size_t count)
 {
-    size_t i = 0;
-    while (i < sv.count && isspace(sv.data[i])) {
-        i += 1;
+    bool result = true;
+    size_t temp_checkpoint = bcc_temp_save();
+    BCC_Http_Request *manifests = calloc(count, sizeof(*manifests));
+    BCC_Http_Request *objects = calloc(2*count, sizeof(*objects));
+    size_t *found = calloc(count, sizeof(*found));
+    BCC_ASSERT(manifests != NULL && objects != NULL && found != NULL && "Buy more RAM lol");
+    BCC_File_Paths deps = {0};
+    size_t found_count = 0;
+    size_t pulled = 0;
+    uint64_t added = 0;
+
+    BCC_Url remote = {0};
+    if (!bcc_net_init()) bcc_return_defer(false);
+    if (!bcc_url_parse(url, &remote)) bcc_return_defer(false);
+
+    for (size_t i = 0; i < count; ++i) {
+        manifests[i].method = "GET";
+        manifests[i].path = bcc_temp_sprintf("manifests/%s", manifest_keys[i]);
+    }
+    if (!bcc_http_pipeline(&remote, manifests, count)) bcc_return_defer(false);
+
+    // NOTE: the key of the object depends on the local headers, so it can only be
+    // requested once the manifest is here
+    for (size_t i = 0; i < count; ++i) {
+        if (manifests[i].status != 200) continue;
+        deps.count = 0;
+        bcc_cache_parse_manifest(bcc_sv_from_parts(manifests[i].body.items, manifests[i].body.count), &deps);
+        uint64_t manifest_key = strtoull(manifest_keys[i], NULL, 16);
+        uint64_t object_key = 0;
+        if (!bcc_cache_object_key(manifest_key, deps.items, deps.count, &object_key)) continue;
+
+        const char *object_path = bcc_temp_sprintf("%02x/%016llx", (unsigned) (object_key >> 56), (unsigned long long) object_key);
+        objects[2*found_count + 0].method = "GET";
+        objects[2*found_count + 0].path = bcc_temp_sprintf("%s.o", object_path);
+        objects[2*found_count + 1].method = "GET";
+        objects[2*found_count + 1].path = bcc_temp_sprintf("%s.d", object_path);
+        found[found_count++] = i;
+    }
+    if (!bcc_http_pipeline(&remote, objects, 2*found_count)) bcc_return_defer(false);
+
+    for (size_t j = 0; j < found_count; ++j) {
+        BCC_Http_Request *object = &objects[2*j + 0];
+        BCC_Http_Request *depfile = &objects[2*j + 1];
+        BCC_Http_Request *manifest = &manifests[found[j]];
+        if (object->status != 200) continue;
+
+        const char *dir = bcc_temp_sprintf("%s/%.2s", cache->dir, object->path);
+        if (!bcc_mkdir_quiet(dir)) bcc_return_defer(false);
+        // NOTE: same order as bcc_cache_store, the manifest goes last
+        if (depfile->status == 200) {
+            if (!bcc_cache_write_atomic(cache, bcc_temp_sprintf("%s/%s", cache->dir, depfile->path), NULL, depfile->body.items, depfile->body.count)) bcc_return_defer(false);
+            added += depfile->body.count;
+        }
+        if (!bcc_cache_write_atomic(cache, bcc_temp_sprintf("%s/%s", cache->dir, object->path), NULL, object->body.items, object->body.count)) bcc_return_defer(false);
+        if (!bcc_cache_write_atomic(cache, bcc_temp_sprintf("%s/%s", cache->dir, manifest->path), NULL, manifest->body.items, manifest->body.count)) bcc_return_defer(false);
+        added += object->body.count + manifest->body.count;
+        pulled += 1;
     }
 
-    return bcc_sv_from_parts(sv.data + i, sv.count - i);
+    bcc_log(BCC_INFO, "pulled %zu of %zu objects from %s", pulled, count, url);
+
+defer:
+    if (added > 0 && !bcc_cache_grow(cache, added)) result = false;
+    bcc_http_requests_free(manifests, count);
+    bcc_http_requests_free(objects, 2*count);
+    free(found);
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
 }
 
-BCC_String_View bcc_sv_trim_right(BCC_String_View sv)
+bool bcc_remote_cache_push(BCC_Cache *cache, const char *url, const char **manifest_keys, size_t count)
 {
-    size_t i = 0;
-    while (i < sv.count && isspace(sv.data[sv.count - 1 - i])) {
-        i += 1;
+    bool result = true;
+    size_t temp_checkpoint = bcc_temp_save();
+    // The depfile, the object and the manifest of every entry
+    BCC_Http_Request *requests = calloc(3*count + 1, sizeof(*requests));
+    BCC_ASSERT(requests != NULL && "Buy more RAM lol");
+    size_t requests_count = 0;
+    BCC_String_Builder manifest = {0};
+    BCC_File_Paths deps = {0};
+
+    BCC_Url remote = {0};
+    if (!bcc_net_init()) bcc_return_defer(false);
+    if (!bcc_url_parse(url, &remote)) bcc_return_defer(false);
+
+    for (size_t i = 0; i < count; ++i) {
+        const char *manifest_path = bcc_temp_sprintf("manifests/%s", manifest_keys[i]);
+        manifest.count = 0;
+        if (!bcc_read_entire_file(bcc_temp_sprintf("%s/%s", cache->dir, manifest_path), &manifest)) bcc_return_defer(false);
+        deps.count = 0;
+        bcc_cache_parse_manifest(bcc_sv_from_parts(manifest.items, manifest.count), &deps);
+        uint64_t object_key = 0;
+        if (!bcc_cache_object_key(strtoull(manifest_keys[i], NULL, 16), deps.items, deps.count, &object_key)) bcc_return_defer(false);
+
+        const char *object_path = bcc_temp_sprintf("%02x/%016llx", (unsigned) (object_key >> 56), (unsigned long long) object_key);
+        const char *depfile_path = bcc_temp_sprintf("%s.d", object_path);
+        if (bcc_file_exists(bcc_temp_sprintf("%s/%s", cache->dir, depfile_path)) > 0) {
+            BCC_Http_Request *request = &requests[requests_count++];
+            request->method = "PUT";
+            request->path = depfile_path;
+            if (!bcc_read_entire_file(bcc_temp_sprintf("%s/%s", cache->dir, depfile_path), &request->body)) bcc_return_defer(false);
+        }
+        BCC_Http_Request *request = &requests[requests_count++];
+        request->method = "PUT";
+        request->path = bcc_temp_sprintf("%s.o", object_path);
+        if (!bcc_read_entire_file(bcc_temp_sprintf("%s/%s", cache->dir, request->path), &request->body)) bcc_return_defer(false);
+        // NOTE: the manifest goes last, the remote serves an entry as soon as its manifest is there
+        request = &requests[requests_count++];
+        request->method = "PUT";
+        request->path = manifest_path;
+        request->body = manifest;
+        memset(&manifest, 0, sizeof(manifest));
     }
 
-    return bcc_sv_from_parts(sv.data, sv.count - i);
+    if (!bcc_http_pipeline(&remote, requests, requests_count)) bcc_return_defer(false);
+    for (size_t i = 0; i < requests_count; ++i) {
+        if (requests[i].status != 201 && requests[i].status != 200) {
+            bcc_log(BCC_ERROR, "could not upload %s to %s: HTTP %d", requests[i].path, url, requests[i].status);
+            bcc_return_defer(false);
+        }
+    }
+    bcc_log(BCC_INFO, "pushed %zu objects to %s", count, url);
+
+defer:
+    bcc_http_requests_free(requests, requests_count);
+    bcc_sb_free(manifest);
+    bcc_da_free(deps);
+    bcc_temp_rewind(temp_checkpoint);
+    return result;
 }
 
-BCC_String_View bcc_sv_trim(BCC_String_View sv)
+// Map a request target of the cache server to a file of the cache. Only the files of the
+// entries are reachable, that is `manifests/<key>` and `<xx>/<key>.<ext>`
+static const char *bcc_cache_server_path(const BCC_Cache *cache, BCC_String_View target, const char **dir)
 {
-    return bcc_sv_trim_right(bcc_sv_trim_left(sv));
+    if (target.count == 0 || target.data[0] != '/') return NULL;
+    target.data += 1;
+    target.count -= 1;
+
+    BCC_String_View parent = bcc_sv_chop_by_delim(&target, '/');
+    bool is_object_dir = parent.count == 2 && isxdigit((unsigned char) parent.data[0]) && isxdigit((unsigned char) parent.data[1]);
+    if (!is_object_dir && !bcc_sv_eq(parent, bcc_sv_from_cstr("manifests"))) return NULL;
+    if (target.count == 0 || target.data[0] == '.') return NULL;
+    for (size_t i = 0; i < target.count; ++i) {
+        if (!isalnum((unsigned char) target.data[i]) && target.data[i] != '.') return NULL;
+    }
+
+    *dir = bcc_temp_sprintf("%s/"SV_Fmt, cache->dir, SV_Arg(parent));
+    return bcc_temp_sprintf("%s/"SV_Fmt, *dir, SV_Arg(target));
 }
 
-BCC_String_View bcc_sv_from_cstr(const char *cstr)
+static void bcc_cache_serve_connection(BCC_Cache *cache, BCC_Socket sock)
 {
-    return bcc_sv_from_parts(cstr, strlen(cstr));
+    BCC_Http_Conn conn = {0};
+    conn.sock = sock;
+    BCC_String_Builder body = {0};
+    BCC_String_Builder out = {0};
+
+    for (;;) {
+        size_t temp_checkpoint = bcc_temp_save();
+        BCC_String_View head;
+        if (bcc_http_read_head(&conn, &head) <= 0) break;
+
+        // GET /manifests/0123456789abcdef HTTP/1.1
+        BCC_String_View line = head;
+        line = bcc_sv_chop_by_delim(&line, '\n');
+        const char *method = bcc_temp_sv_to_cstr(bcc_sv_chop_by_delim(&line, ' '));
+        BCC_String_View target = bcc_sv_chop_by_delim(&line, ' ');
+        const char *dir = NULL;
+        const char *path = bcc_cache_server_path(cache, target, &dir);
+        const char *target_cstr = bcc_temp_sv_to_cstr(target);
+
+        size_t length = 0;
+        int status = 400;
+        body.count = 0;
+        // NOTE: the body of a request that is too large is not read, so the connection cannot
+        // go on after the response
+        bool too_large = false;
+        if (!bcc_http_content_length(head, &length)) {
+            path = NULL;
+        } else if (length > BCC_REMOTE_CACHE_MAX_BODY) {
+            too_large = true;
+        } else if (!bcc_http_read_body(&conn, length, &body)) {
+            break;
+        }
+
+        if (too_large) {
+            status = 413;
+        } else if (path == NULL) {
+            status = 400;
+        } else if (strcmp(method, "GET") == 0) {
+            body.count = 0;
+            if (bcc_file_exists(path) > 0 && bcc_read_entire_file(path, &body)) {
+                bcc_cache_touch(path);
+                status = 200;
+            } else {
+                status = 404;
+            }
+        } else if (strcmp(method, "PUT") == 0) {
+            status = 500;
+            if (bcc_mkdir_quiet(dir) && bcc_cache_write_atomic(cache, path, NULL, body.items, body.count)) {
+                bcc_cache_grow(cache, body.count);
+                status = 201;
+            }
+        } else {
+            status = 405;
+        }
+
+        const char *reason = status == 200 ? "OK" :
+                             status == 201 ? "Created" :
+                             status == 404 ? "Not Found" :
+                             status == 405 ? "Method Not Allowed" :
+                             status == 413 ? "Payload Too Large" :
+                             status == 400 ? "Bad Request" : "Internal Server Error";
+        size_t body_size = status == 200 ? body.count : 0;
+        out.count = 0;
+        bcc_sb_append_cstr(&out, bcc_temp_sprintf("HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n%s\r\n", status, reason, body_size, too_large ? "Connection: close\r\n" : ""));
+        bcc_da_append_many(&out, body.items, body_size);
+        bcc_log(BCC_INFO, "%s %s %d", method, target_cstr, status);
+        bcc_temp_rewind(temp_checkpoint);
+        if (!bcc_socket_send(sock, out.items, out.count) || too_large) break;
+    }
+
+    bcc_sb_free(conn.buffer);
+    bcc_sb_free(body);
+    bcc_sb_free(out);
 }
 
-bool bcc_sv_eq(BCC_String_View a, BCC_String_View b)
+bool bcc_cache_server(const char *dir, const char *address)
 {
-    if (a.count != b.count) {
+    BCC_Cache cache;
+    if (!bcc_cache_init(&cache, dir)) return false;
+    if (!bcc_net_init()) return false;
+
+    const char *host = "127.0.0.1";
+    const char *port = address;
+    const char *colon = strrchr(address, ':');
+    if (colon != NULL) {
+        host = bcc_temp_sv_to_cstr(bcc_sv_from_parts(address, colon - address));
+        port = colon + 1;
+    }
+
+    struct addrinfo hints = {0};
+    struct addrinfo *addrs = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int error = getaddrinfo(host, port, &hints, &addrs);
+    if (error != 0) {
+        bcc_log(BCC_ERROR, "could not resolve %s: %s", host, gai_strerror(error));
         return false;
-    } else {
-        return memcmp(a.data, b.data, a.count) == 0;
     }
-}
 
-// RETURNS:
-//  0 - file does not exists
-//  1 - file exists
-// -1 - error while checking if file exists. The error is logged
-int bcc_file_exists(const char *file_path)
-{
-#if _WIN32
-    // TODO: distinguish between "does not exists" and other errors
-    DWORD dwAttrib = GetFileAttributesA(file_path);
-    return dwAttrib != INVALID_FILE_ATTRIBUTES;
-#else
-    struct stat statbuf;
-    if (stat(file_path, &statbuf) < 0) {
-        if (errno == ENOENT) return 0;
-        bcc_log(BCC_ERROR, "Could not check if file %s exists: %s", file_path, strerror(errno));
-        return -1;
+    BCC_Socket server = BCC_INVALID_SOCKET;
+    for (struct addrinfo *addr = addrs; addr != NULL; addr = addr->ai_next) {
+        server = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (server == BCC_INVALID_SOCKET) continue;
+        int yes = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char*) &yes, sizeof(yes));
+        if (bind(server, addr->ai_addr, (int) addr->ai_addrlen) == 0 && listen(server, 16) == 0) break;
+        bcc_socket_close(server);
+        server = BCC_INVALID_SOCKET;
+    }
+    freeaddrinfo(addrs);
+    if (server == BCC_INVALID_SOCKET) {
+        bcc_log(BCC_ERROR, "could not listen on %s:%s: %s", host, port, bcc_net_error());
+        return false;
+    }
+
+    bcc_log(BCC_INFO, "serving the cache %s on http://%s:%s/", dir, host, port);
+    for (;;) {
+        BCC_Socket client = accept(server, NULL, NULL);
+        if (client == BCC_INVALID_SOCKET) {
+#ifndef _WIN32
+            if (errno == EINTR) continue;
+#endif // _WIN32
+            bcc_log(BCC_ERROR, "could not accept a connection: %s", bcc_net_error());
+            continue;
+        }
+        bcc_socket_set_timeout(client, BCC_REMOTE_CACHE_TIMEOUT);
+        bcc_cache_serve_connection(&cache, client);
+        bcc_socket_close(client);
     }
-    return 1;
-#endif
 }
 
 // minirent.h SOURCE BEGIN ////////////////////////////////////////
@@ -12,126 +12,185 @@ static const char *raylib_modules[] = {
     "utils",
 };
 
-bool build_program(void)
+bool build_program(BCC_Graph *graph)
 {
-    bool result = true;
-    BCC_Cmd cmd = {0};
-    BCC_Procs procs = {0};
-
 #ifdef BUILD_HOTRELOAD
 #error "TODO: hotreloading is not yet supported."
 #else
-    cmd.count = 0;
+    BCC_Rule *rule = bcc_graph_rule(graph);
+    bcc_rule_outputs(rule, "./build/program.res");
+    bcc_rule_inputs(rule, "./src/program.rc");
     #ifdef _WIN32
         // On windows, mingw doesn't have the `x86_64-w64-mingw32-` prefix for windres.
         // For gcc, you can use both `x86_64-w64-mingw32-gcc` and just `gcc`
-        bcc_cmd_append(&cmd, "windres");
+        bcc_cmd_append(&rule->cmd, "windres");
     #else
-        bcc_cmd_append(&cmd, "x86_64-w64-mingw32-windres");
+        bcc_cmd_append(&rule->cmd, "x86_64-w64-mingw32-windres");
     #endif // _WIN32
-        bcc_cmd_append(&cmd, "./src/program.rc");
-        bcc_cmd_append(&cmd, "-O", "coff");
-        bcc_cmd_append(&cmd, "-o", "./build/program.res");
-        
-    if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
-    cmd.count = 0;
-    bcc_cmd_append(&cmd, "gcc");
-    bcc_cmd_append(&cmd, "-mwindows", "-Wall", "-Wextra", "-ggdb");
-    bcc_cmd_append(&cmd, "-I./build/");
-    bcc_cmd_append(&cmd, "-I./raylib/raylib-"RAYLIB_VERSION"/src/");
-    bcc_cmd_append(&cmd, "-o", "./build/program");
-    bcc_cmd_append(&cmd,
-        "./src/program.c",
+        bcc_cmd_append(&rule->cmd, "./src/program.rc");
+        bcc_cmd_append(&rule->cmd, "-O", "coff");
+        bcc_cmd_append(&rule->cmd, "-o", "./build/program.res");
+
+    // The flags of the game sources. The heavy raylib headers they share are precompiled with them
+    BCC_Cmd flags = {0};
+    bcc_cmd_append(&flags, "gcc");
+    bcc_cmd_append(&flags, "-Wall", "-Wextra", "-ggdb");
+    bcc_cmd_append(&flags, "-I./build/");
+    bcc_cmd_append(&flags, "-I./raylib/raylib-"RAYLIB_VERSION"/src/");
+
+    if (!bcc_mkdir_if_not_exists("./build/pch")) return false;
+    const char *pch_headers[] = {
+        "./raylib/raylib-"RAYLIB_VERSION"/src/raylib.h",
+        "./raylib/raylib-"RAYLIB_VERSION"/src/raymath.h",
+        "./raylib/raylib-"RAYLIB_VERSION"/src/rlgl.h",
+    };
+    const char *pch = bcc_graph_pch(graph, "./build/pch", pch_headers, BCC_ARRAY_LEN(pch_headers), flags);
+    if (pch == NULL) {
+        bcc_cmd_free(flags);
+        return false;
+    }
+
+    rule = bcc_graph_rule(graph);
+    bcc_rule_outputs(rule, "./build/program.o");
+    bcc_rule_inputs(rule, "./src/program.c");
+    bcc_da_append_many(&rule->cmd, flags.items, flags.count);
+    bcc_rule_pch(rule, pch);
+    bcc_cmd_append(&rule->cmd, "-c", "./src/program.c");
+    bcc_cmd_append(&rule->cmd, "-o", "./build/program.o");
+    bcc_rule_depfile(rule, "./build/program.d");
+    rule->cacheable = true;
+    bcc_cmd_free(flags);
+
+    const char *libraylib_path = bcc_temp_sprintf("./build/raylib/%s/libraylib.a", BUILD_TARGET_NAME);
+    rule = bcc_graph_rule(graph);
+    bcc_rule_outputs(rule, "./build/program.exe");
+    bcc_rule_inputs(rule, "./build/program.o", "./build/program.res", libraylib_path);
+    bcc_cmd_append(&rule->cmd, "gcc");
+    bcc_cmd_append(&rule->cmd, "-mwindows", "-ggdb");
+    bcc_cmd_append(&rule->cmd, "-o", "./build/program.exe");
+    bcc_cmd_append(&rule->cmd,
+        "./build/program.o",
         "./build/program.res"
         );
-    bcc_cmd_append(&cmd,
+    bcc_cmd_append(&rule->cmd,
         bcc_temp_sprintf("-L./build/raylib/%s", BUILD_TARGET_NAME),
         "-l:libraylib.a");
-    bcc_cmd_append(&cmd, "-lwinmm", "-lgdi32");
-    bcc_cmd_append(&cmd, "-static");
-    if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
+    bcc_cmd_append(&rule->cmd, "-lwinmm", "-lgdi32");
+    bcc_cmd_append(&rule->cmd, "-static");
+    if (!bcc_rule_linker(rule)) return false;
 #endif // BUILD_HOTRELOAD
 
-defer:
-    bcc_cmd_free(cmd);
-    bcc_da_free(procs);
-    return result;
+    return true;
 }
 
-bool build_raylib()
+bool build_raylib(BCC_Graph *graph, BCC_Unity *unity)
 {
-    bool result = true;
-    BCC_Cmd cmd = {0};
-    BCC_File_Paths object_files = {0};
+    if (!bcc_mkdir_if_not_exists("./build/raylib")) return false;
 
-    if (!bcc_mkdir_if_not_exists("./build/raylib")) {
-        bcc_return_defer(false);
-    }
+    const char *build_path = bcc_temp_sprintf("./build/raylib/%s", BUILD_TARGET_NAME);
 
-    BCC_Procs procs = {0};
+    if (!bcc_mkdir_if_not_exists(build_path)) return false;
 
-    const char *build_path = bcc_temp_sprintf("./build/raylib/%s", BUILD_TARGET_NAME);
+    const char *sources[BCC_ARRAY_LEN(raylib_modules)];
+    const char *objects[BCC_ARRAY_LEN(raylib_modules)];
+    for (size_t i = 0; i < BCC_ARRAY_LEN(raylib_modules); ++i) {
+        sources[i] = bcc_temp_sprintf("./raylib/raylib-"RAYLIB_VERSION"/src/%s.c", raylib_modules[i]);
+        objects[i] = bcc_temp_sprintf("%s/%s.o", build_path, raylib_modules[i]);
+    }
 
-    if (!bcc_mkdir_if_not_exists(build_path)) {
-        bcc_return_defer(false);
+    if (bcc_options.unity) {
+        if (!bcc_unity_plan(unity, build_path, sources, objects, BCC_ARRAY_LEN(raylib_modules), bcc_options.unity_groups)) return false;
+    } else {
+        for (size_t i = 0; i < BCC_ARRAY_LEN(raylib_modules); ++i) {
+            BCC_Unity_Group group = {0};
+            bcc_da_append(&group.sources, sources[i]);
+            group.object = objects[i];
+            bcc_da_append(unity, group);
+        }
     }
 
-    for (size_t i = 0; i < BCC_ARRAY_LEN(raylib_modules); ++i) {
-        const char *input_path = bcc_temp_sprintf("./raylib/raylib-"RAYLIB_VERSION"/src/%s.c", raylib_modules[i]);
-        const char *output_path = bcc_temp_sprintf("%s/%s.o", build_path, raylib_modules[i]);
-        output_path = bcc_temp_sprintf("%s/%s.o", build_path, raylib_modules[i]);
+    BCC_File_Paths object_files = {0};
+
+    for (size_t i = 0; i < unity->count; ++i) {
+        const BCC_Unity_Group *group = &unity->items[i];
+        const char *input_path = group->path ? group->path : group->sources.items[0];
+        const char *output_path = group->object;
+        const char *depfile_path = bcc_temp_sprintf("%.*s.d", (int) strlen(output_path) - 2, output_path);
 
         bcc_da_append(&object_files, output_path);
 
-        if (bcc_needs_rebuild(output_path, &input_path, 1)) {
-            cmd.count = 0;
-            bcc_cmd_append(&cmd, "gcc");
-            bcc_cmd_append(&cmd, "-ggdb", "-DPLATFORM_DESKTOP", "-fPIC");
-            bcc_cmd_append(&cmd, "-DPLATFORM_DESKTOP");
-            bcc_cmd_append(&cmd, "-fPIC");
-            bcc_cmd_append(&cmd, "-I./raylib/raylib-"RAYLIB_VERSION"/src/external/glfw/include");
-            bcc_cmd_append(&cmd, "-I./raylib/raylib-"RAYLIB_VERSION"/src/external/glfw/deps/mingw");
-            bcc_cmd_append(&cmd, "-c", input_path);
-            bcc_cmd_append(&cmd, "-o", output_path);
-
-            BCC_Proc proc = bcc_cmd_run_async(cmd);
-            bcc_da_append(&procs, proc);
-        }
+        BCC_Rule *rule = bcc_graph_rule(graph);
+        bcc_rule_outputs(rule, output_path);
+        if (group->path) bcc_rule_inputs(rule, group->path);
+        bcc_da_append_many(&rule->inputs, group->sources.items, group->sources.count);
+        bcc_cmd_append(&rule->cmd, "gcc");
+        bcc_cmd_append(&rule->cmd, "-ggdb", "-DPLATFORM_DESKTOP", "-fPIC");
+        bcc_cmd_append(&rule->cmd, "-DPLATFORM_DESKTOP");
+        bcc_cmd_append(&rule->cmd, "-fPIC");
+        bcc_cmd_append(&rule->cmd, "-I./raylib/raylib-"RAYLIB_VERSION"/src/external/glfw/include");
+        bcc_cmd_append(&rule->cmd, "-I./raylib/raylib-"RAYLIB_VERSION"/src/external/glfw/deps/mingw");
+        bcc_cmd_append(&rule->cmd, "-c", input_path);
+        bcc_cmd_append(&rule->cmd, "-o", output_path);
+        bcc_rule_depfile(rule, depfile_path);
+        rule->cacheable = true;
     }
-    cmd.count = 0;
-
-    if (!bcc_procs_wait(procs)) bcc_return_defer(false);
 
 #ifndef BUILD_HOTRELOAD
     const char *libraylib_path = bcc_temp_sprintf("%s/libraylib.a", build_path);
 
-    if (bcc_needs_rebuild(libraylib_path, object_files.items, object_files.count)) {
-        bcc_cmd_append(&cmd, "ar", "-crs", libraylib_path);
-        for (size_t i = 0; i < BCC_ARRAY_LEN(raylib_modules); ++i) {
-            const char *input_path = bcc_temp_sprintf("%s/%s.o", build_path, raylib_modules[i]);
-            bcc_cmd_append(&cmd, input_path);
-        }
-        if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
-    }
+    BCC_Rule *rule = bcc_graph_rule(graph);
+    bcc_rule_outputs(rule, libraylib_path);
+    bcc_da_append_many(&rule->inputs, object_files.items, object_files.count);
+    bcc_rule_ar(rule, false);
 #else
 #error "TODO: dynamic raylib is not supported for TARGET_WIN64_MINGW"
 #endif // BUILD_HOTRELOAD
 
-defer:
-    bcc_cmd_free(cmd);
     bcc_da_free(object_files);
-    return result;
+    return true;
 }
 
 bool build_chain(int argc, char **argv)
 {
-    build_raylib();
-    build_program();
+    (void) argc;
+    (void) argv;
 
-#ifndef BUILD_HOTRELOAD
+    bool result = true;
+    BCC_Graph graph = {0};
+    BCC_Unity unity = {0};
+    BCC_Jobs jobs = {0};
     BCC_Cmd cmd = {0};
+
+    for (bool retried = false;; retried = true) {
+        if (!build_raylib(&graph, &unity)) bcc_return_defer(false);
+        if (!build_program(&graph)) bcc_return_defer(false);
+        bool built = bcc_graph_build(&graph, &jobs);
+
+        // The raylib modules do not all combine into one translation unit. The ones that did
+        // not are split back up and the build goes once more without them.
+        bool failed_unity = bcc_unity_fallback(&unity, &graph);
+        if (built) break;
+        if (retried || !failed_unity) bcc_return_defer(false);
+        bcc_graph_free(&graph);
+        bcc_unity_free(&unity);
+    }
+
+#ifndef BUILD_HOTRELOAD
+    if (bcc_options.args.count > 1 && strcmp(bcc_options.args.items[1], "bench-link") == 0) {
+        size_t runs = bcc_options.args.count > 2 ? strtoul(bcc_options.args.items[2], NULL, 10) : 5;
+        if (!bcc_bench_link(&graph, "./build/program.exe", runs)) bcc_return_defer(false);
+        bcc_return_defer(true);
+    }
+
     const char *program_binary = "build/program.exe";
     bcc_cmd_append(&cmd, program_binary);
-    if (!bcc_cmd_run_sync(cmd)) return 1;
+    if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
 #endif
-}
\ No newline at end of file
+
+defer:
+    bcc_cmd_free(cmd);
+    bcc_jobs_free(&jobs);
+    bcc_unity_free(&unity);
+    bcc_graph_free(&graph);
+    return result;
+}
@@ -0,0 +1,171 @@
+// bcc_ar_write has to produce the very same archive as `ar -crsD`, for ELF and for COFF objects,
+// and bcc_rule_ar has to fall back to `ar` on a fresh archive. COFF objects come from llc.
+//
+//   cc -o build/test_ar tests/ar.c && ./build/test_ar
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#define BCC_VERSION "test"
+#include "../bcc.h"
+
+#define DIR "build/test_ar.d/"
+
+static const char *elf_sources[][2] = {
+    {DIR "a.c", "int a_data = 1;\nint a_common;\nint a_fn(void) { return a_data; }\n__attribute__((weak)) int a_weak(void) { return 0; }\n"},
+    {DIR "b.c", "static int b_local(void) { return 2; }\nint b_fn(void) { return b_local(); }\n"},
+    {DIR "a_really_long_member_name.c", "const char *long_name_fn(void) { return \"long\"; }\n"},
+};
+
+static const char *coff_plain_ll =
+    "target triple = \"x86_64-w64-windows-gnu\"\n"
+    "@coff_data = global i32 3\n"
+    "@coff_common = common global i32 0\n"
+    "define void @coff_fn() { ret void }\n";
+
+static const char *coff_weak_ll =
+    "target triple = \"x86_64-w64-windows-gnu\"\n"
+    "define weak void @coff_weak_fn() { ret void }\n"
+    "define void @coff_strong_fn() { ret void }\n";
+
+static bool same_files(const char *a, const char *b)
+{
+    BCC_String_Builder sa = {0};
+    BCC_String_Builder sb = {0};
+    bool same = bcc_read_entire_file(a, &sa) && bcc_read_entire_file(b, &sb) &&
+                sa.count == sb.count && memcmp(sa.items, sb.items, sa.count) == 0;
+    bcc_sb_free(sa);
+    bcc_sb_free(sb);
+    if (!same) bcc_log(BCC_ERROR, "FAIL: %s differs from %s", a, b);
+    return same;
+}
+
+// Archive the members both ways, as a regular and as a thin archive, and compare
+static bool compare_with_ar(const char *name, const char **members, size_t count)
+{
+    bool result = true;
+    BCC_Cmd cmd = {0};
+    for (int thin = 0; thin <= 1; ++thin) {
+        const char *ours = bcc_temp_sprintf(DIR "%s%s.a", name, thin ? "_thin" : "");
+        const char *theirs = bcc_temp_sprintf(DIR "%s%s_ar.a", name, thin ? "_thin" : "");
+        remove(ours);
+        remove(theirs);
+        if (bcc_ar_write(ours, members, count, thin) != 1) {
+            bcc_log(BCC_ERROR, "FAIL: bcc_ar_write could not write %s", ours);
+            bcc_return_defer(false);
+        }
+        cmd.count = 0;
+        bcc_cmd_append(&cmd, "ar", thin ? "-crsTD" : "-crsD", theirs);
+        bcc_da_append_many(&cmd, members, count);
+        if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
+        if (!same_files(ours, theirs)) bcc_return_defer(false);
+    }
+
+defer:
+    bcc_cmd_free(cmd);
+    return result;
+}
+
+static bool archive_indexes(const char *archive_path, const char *symbol)
+{
+    BCC_String_Builder content = {0};
+    BCC_Ar_Members members = {0};
+    bool found = false;
+    if (bcc_read_entire_file(archive_path, &content) &&
+        bcc_ar_parse((const unsigned char *) content.items, content.count, &members)) {
+        for (size_t i = 0; i < members.count; ++i) {
+            for (size_t j = 0; j < members.items[i].symbols.count; ++j) {
+                if (strcmp(members.items[i].symbols.items[j], symbol) == 0) found = true;
+            }
+            bcc_da_free(members.items[i].symbols);
+        }
+    }
+    bcc_da_free(members);
+    bcc_sb_free(content);
+    if (!found) bcc_log(BCC_ERROR, "FAIL: %s is not in the index of %s", symbol, archive_path);
+    return found;
+}
+
+int main(void)
+{
+    bool result = true;
+    BCC_Cmd cmd = {0};
+    if (!bcc_mkdir_if_not_exists("build")) return 1;
+    if (!bcc_mkdir_if_not_exists(DIR)) return 1;
+
+    // ELF
+    const char *elf_objects[BCC_ARRAY_LEN(elf_sources)];
+    for (size_t i = 0; i < BCC_ARRAY_LEN(elf_sources); ++i) {
+        const char *source = elf_sources[i][0];
+        if (!bcc_write_entire_file(source, elf_sources[i][1], strlen(elf_sources[i][1]))) bcc_return_defer(false);
+        elf_objects[i] = bcc_temp_sprintf("%.*so", (int) strlen(source) - 1, source);
+        cmd.count = 0;
+        bcc_cmd_append(&cmd, "cc", "-fcommon", "-c", source, "-o", elf_objects[i]);
+        if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
+    }
+    if (!compare_with_ar("elf", elf_objects, BCC_ARRAY_LEN(elf_objects))) bcc_return_defer(false);
+    bcc_log(BCC_INFO, "OK: ELF archives are the same as `ar -crsD`");
+
+    // COFF
+    cmd.count = 0;
+    bcc_cmd_append(&cmd, "llc", "--version");
+    if (bcc_cmd_run_sync_quiet(cmd)) {
+        const char *lls[][2] = {{DIR "coff_plain.ll", coff_plain_ll}, {DIR "coff_weak.ll", coff_weak_ll}};
+        const char *coff_objects[BCC_ARRAY_LEN(lls)];
+        for (size_t i = 0; i < BCC_ARRAY_LEN(lls); ++i) {
+            if (!bcc_write_entire_file(lls[i][0], lls[i][1], strlen(lls[i][1]))) bcc_return_defer(false);
+            coff_objects[i] = bcc_temp_sprintf("%.*so", (int) strlen(lls[i][0]) - 2, lls[i][0]);
+            cmd.count = 0;
+            bcc_cmd_append(&cmd, "llc", "-filetype=obj", lls[i][0], "-o", coff_objects[i]);
+            if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
+        }
+        if (!compare_with_ar("coff", coff_objects, 1)) bcc_return_defer(false);
+        // NOTE: GNU ar does not index weak externals, so that one is checked on its own
+        remove(DIR "coff_weak.a");
+        if (bcc_ar_write(DIR "coff_weak.a", coff_objects, BCC_ARRAY_LEN(coff_objects), false) != 1) bcc_return_defer(false);
+        if (!archive_indexes(DIR "coff_weak.a", "coff_weak_fn")) bcc_return_defer(false);
+        if (!archive_indexes(DIR "coff_weak.a", "coff_strong_fn")) bcc_return_defer(false);
+        bcc_log(BCC_INFO, "OK: COFF archives are the same as `ar -crsD`, weak externals are indexed");
+    } else {
+        bcc_log(BCC_INFO, "SKIP: no llc to make COFF objects with");
+    }
+
+    // Fallback to `ar` once an input is an LTO object, the old members must not survive it
+    const char *lto_object = DIR "lto.o";
+    cmd.count = 0;
+    bcc_cmd_append(&cmd, "cc", "-flto", "-c", elf_sources[1][0], "-o", lto_object);
+    if (!bcc_cmd_run_sync(cmd)) bcc_return_defer(false);
+    const char *archive_path = DIR "fallback.a";
+    if (bcc_ar_write(archive_path, elf_objects, BCC_ARRAY_LEN(elf_objects), false) != 1) bcc_return_defer(false);
+
+    BCC_Rule rule = {0};
+    bcc_da_append(&rule.inputs, elf_objects[0]);
+    bcc_da_append(&rule.inputs, lto_object);
+    bcc_da_append(&rule.outputs, archive_path);
+    bcc_rule_ar(&rule, false);
+    int built = rule.builtin(&rule);
+    bool fresh = built == -1 && bcc_file_exists(archive_path) == 0 && bcc_cmd_run_sync(rule.cmd);
+    bcc_cmd_free(rule.cmd);
+    bcc_da_free(rule.inputs);
+    bcc_da_free(rule.outputs);
+    if (!fresh) {
+        bcc_log(BCC_ERROR, "FAIL: the archive has not been rebuilt from scratch by `ar`");
+        bcc_return_defer(false);
+    }
+    BCC_String_Builder content = {0};
+    if (!bcc_read_entire_file(archive_path, &content)) bcc_return_defer(false);
+    bcc_sb_append_null(&content);
+    bool stale = strstr(content.items, "a_really_long_member_name.o") != NULL;
+    bcc_sb_free(content);
+    if (stale) {
+        bcc_log(BCC_ERROR, "FAIL: %s still has a member that is not an input anymore", archive_path);
+        bcc_return_defer(false);
+    }
+    bcc_log(BCC_INFO, "OK: the `ar` fallback starts from a fresh archive");
+
+defer:
+    bcc_cmd_free(cmd);
+    return result ? 0 : 1;
+}
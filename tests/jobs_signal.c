@@ -0,0 +1,53 @@
+// SIGINT while bcc_jobs_wait runs has to cancel the jobs and fail the wait, and a job that
+// ignores SIGTERM must not hold the cancel up.
+//
+//   cc -o build/test_jobs_signal tests/jobs_signal.c && ./build/test_jobs_signal
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#define BCC_VERSION "test"
+#include "../bcc.h"
+
+int main(void)
+{
+#ifdef _WIN32
+    bcc_log(BCC_INFO, "SKIP: no SIGINT to send on Windows");
+    return 0;
+#else
+    BCC_Jobs jobs = {0};
+    jobs.max_jobs = 3;
+    // NOTE: the jobserver bcc serves itself has as many slots as bcc_max_jobs()
+    bcc_options.max_jobs = 3;
+    BCC_Cmd cmd = {0};
+
+    // One of the jobs interrupts bcc itself while the other one keeps running
+    bcc_cmd_append(&cmd, "sh", "-c", "sleep 0.2; kill -INT $PPID");
+    bcc_jobs_push(&jobs, cmd);
+    cmd.count = 0;
+    bcc_cmd_append(&cmd, "sleep", "10");
+    bcc_jobs_push(&jobs, cmd);
+    cmd.count = 0;
+    bcc_cmd_append(&cmd, "sh", "-c", "trap '' TERM; sleep 10");
+    bcc_jobs_push(&jobs, cmd);
+
+    uint64_t start = bcc_trace_now();
+    bool ok = bcc_jobs_wait(&jobs);
+    double secs = (bcc_trace_now() - start)/1e6;
+
+    bcc_cmd_free(cmd);
+    bcc_jobs_free(&jobs);
+    if (ok) {
+        bcc_log(BCC_ERROR, "FAIL: bcc_jobs_wait has succeeded after SIGINT");
+        return 1;
+    }
+    if (secs > 5) {
+        bcc_log(BCC_ERROR, "FAIL: the running jobs have not been cancelled, took %.3fs", secs);
+        return 1;
+    }
+    bcc_log(BCC_INFO, "OK: interrupted after %.3fs", secs);
+    return 0;
+#endif // _WIN32
+}